@@ -0,0 +1,334 @@
+// Benchmarks for inspect-deps on synthetic dependency trees.
+//
+// Generates a tree of minimal hand-written ELF64 shared objects in a temp dir (no compiler
+// needed), then times graph building, library resolution, ld.so.cache lookups, package
+// reduction and every output mode. Results are written to stdout as JSON.
+
+#define INSPECT_DEPS_NO_MAIN
+#include "../main.cpp"
+#include "synthetic_elf.hpp"
+
+#include <chrono>
+#include <random>
+
+namespace
+{
+struct BenchConfig
+{
+    int depth = 6;
+    int width = 40;
+    int fanout = 4;
+    double diamond = 0.5;
+    double origin = 0.5;
+    size_t lib_size = 16 * 1024;
+    int iterations = 20;
+    size_t jobs = 0;
+    unsigned seed = 1;
+};
+
+struct BenchResult
+{
+    std::string name;
+    int iterations;
+    double mean_us;
+    double min_us;
+    double median_us;
+    double max_us;
+};
+
+struct BenchReport
+{
+    BenchConfig config;
+    size_t libraries;
+    size_t nodes;
+    std::vector<BenchResult> results;
+};
+
+struct SyntheticTree
+{
+    fs::path root_dir;
+    std::string binary;
+    std::vector<std::string> sonames;
+    std::vector<std::string> lib_dirs;
+};
+
+// Level k (1..depth) lives in lib/L<k> with `width` libraries. Every object needs `fanout`
+// libraries from the next level: with probability `diamond` a random one (so parents share
+// children), otherwise a distinct slot. A fraction `origin` of libraries find the next level
+// through $ORIGIN (alternating DT_RUNPATH and DT_RPATH); the rest rely on LD_LIBRARY_PATH.
+SyntheticTree generate_tree(const fs::path& dir, const BenchConfig& cfg)
+{
+    SyntheticTree tree{dir, (dir / "bin" / "app").string(), {}, {}};
+    std::mt19937 rng(cfg.seed);
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+    std::uniform_int_distribution<int> pick(0, cfg.width - 1);
+
+    auto soname = [](int level, int i) { return std::format("libbench_{}_{}.so", level, i); };
+    auto children = [&](int next, int i)
+    {
+        std::vector<std::string> out;
+        for (int j = 0; j < cfg.fanout; ++j)
+        {
+            const int slot = coin(rng) < cfg.diamond ? pick(rng) : (i * cfg.fanout + j) % cfg.width;
+            auto name = soname(next, slot);
+            if (r::find(out, name) == out.end()) out.push_back(std::move(name));
+        }
+        out.emplace_back("libc.so.6");
+        return out;
+    };
+
+    fs::create_directories(dir / "bin");
+    for (int level = 1; level <= cfg.depth; ++level)
+    {
+        const fs::path level_dir = dir / "lib" / std::format("L{}", level);
+        fs::create_directories(level_dir);
+        tree.lib_dirs.push_back(level_dir.string());
+    }
+
+    SyntheticElf binary;
+    binary.needed = children(1, 0);
+    binary.search_path = "$ORIGIN/../lib/L1";
+    binary.min_size = cfg.lib_size;
+    write_elf(tree.binary, binary);
+    for (int level = 1; level <= cfg.depth; ++level)
+    {
+        for (int i = 0; i < cfg.width; ++i)
+        {
+            const bool leaf = level == cfg.depth;
+            SyntheticElf lib;
+            lib.needed = leaf ? std::vector<std::string>{"libc.so.6"} : children(level + 1, i);
+            lib.soname = soname(level, i);
+            if (!leaf && coin(rng) < cfg.origin) lib.search_path = std::format("$ORIGIN/../L{}", level + 1);
+            lib.use_rpath = i % 2 == 1;
+            lib.min_size = cfg.lib_size;
+            write_elf(fs::path(tree.lib_dirs[level - 1]) / lib.soname, lib);
+            tree.sonames.push_back(lib.soname);
+        }
+    }
+    return tree;
+}
+
+template <typename F>
+BenchResult measure(std::string name, int iterations, F&& body)
+{
+    using clock = std::chrono::steady_clock;
+    body();
+
+    std::vector<double> samples;
+    for (int i = 0; i < iterations; ++i)
+    {
+        const auto start = clock::now();
+        body();
+        samples.push_back(std::chrono::duration<double, std::micro>(clock::now() - start).count());
+    }
+    r::sort(samples);
+    return {
+        std::move(name), iterations,
+        std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size(),
+        samples.front(), samples[samples.size() / 2], samples.back()
+    };
+}
+
+// Output benchmarks print the real thing; stdout points at /dev/null meanwhile.
+class SilencedStdout
+{
+    int saved = -1;
+
+public:
+    SilencedStdout()
+    {
+        std::cout.flush();
+        std::fflush(stdout);
+        saved = dup(STDOUT_FILENO);
+        const int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+
+    SilencedStdout(const SilencedStdout&) = delete;
+    SilencedStdout& operator=(const SilencedStdout&) = delete;
+
+    ~SilencedStdout()
+    {
+        std::cout.flush();
+        std::fflush(stdout);
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+};
+
+BenchReport run_benchmarks(const SyntheticTree& tree, const BenchConfig& cfg)
+{
+    BenchReport report{cfg, tree.sonames.size(), 0, {}};
+    auto& results = report.results;
+    const int n = cfg.iterations;
+    const size_t jobs = cfg.jobs ? cfg.jobs : std::max(1u, std::thread::hardware_concurrency());
+
+    results.push_back(measure("build/cold/serial", n, [&]
+    {
+        DepGraph g;
+        g.build(tree.binary, false, false, 1);
+    }));
+    results.push_back(measure(std::format("build/cold/jobs={}", jobs), n, [&]
+    {
+        DepGraph g;
+        g.build(tree.binary, false, false, jobs);
+    }));
+
+    auto shared = std::make_shared<LibraryCache>();
+    results.push_back(measure("build/warm/serial", n, [&]
+    {
+        DepGraph g(shared);
+        g.build(tree.binary, false, false, 1);
+    }));
+
+    const ElfArch arch{ELFIO::ELFCLASS64, EM_X86_64, 0};
+    DepGraph resolver;
+    resolver.prepare(tree.binary);
+    results.push_back(measure("resolve_library", n, [&]
+    {
+        for (const auto& name : tree.sonames)
+        {
+            if (!resolver.resolve_library(name, {}, {}, {}, arch)) throw std::runtime_error("unresolved " + name);
+        }
+    }));
+
+    const std::array<std::string, 8> ld_names = {
+        "libc.so.6", "libm.so.6", "libstdc++.so.6", "libgcc_s.so.1", "libz.so.1", "libpthread.so.0",
+        "libbench_missing.so", "libzzz_missing.so.9"
+    };
+    const LdCache& ld_cache = resolver.cache->ld_cache;
+    results.push_back(measure("ld_cache/resolve", n, [&]
+    {
+        for (int rep = 0; rep < 1000; ++rep)
+        {
+            for (const auto& name : ld_names) (void)ld_cache.resolve(name, arch);
+        }
+    }));
+
+    DepGraph graph;
+    graph.build(tree.binary, false, false, 1);
+    report.nodes = graph.nodes.size();
+    // One synthetic package per level, so the reduction has real work to do.
+    for (auto& node : graph.nodes)
+    {
+        node.pkg = node.path.empty() ? "-" : fs::path(node.path).parent_path().filename().string();
+    }
+    results.push_back(measure("get_minimal_pkgs", n, [&] { (void)graph.get_minimal_pkgs(); }));
+
+    const std::string deepest = tree.sonames.back();
+    auto mode = [](auto set)
+    {
+        OutputOptions opt;
+        opt.no_pkg = true;
+        set(opt);
+        return opt;
+    };
+    const std::array<std::pair<std::string, OutputOptions>, 12> modes = {{
+        {"output/default", mode([](OutputOptions&) {})},
+        {"output/tree", mode([](OutputOptions& o) { o.show_tree = true; })},
+        {"output/json", mode([](OutputOptions& o) { o.show_json = true; })},
+        {"output/ndjson", mode([](OutputOptions& o) { o.show_ndjson = true; })},
+        {"output/pkg-list", mode([](OutputOptions& o) { o.show_pkg_list = true; })},
+        {"output/dot", mode([](OutputOptions& o) { o.show_dot = true; })},
+        {"output/why", mode([&](OutputOptions& o) { o.why_lib = deepest; })},
+        {"output/dominators", mode([](OutputOptions& o) { o.show_dominators = true; })},
+        {"output/cost", mode([](OutputOptions& o) { o.show_cost = true; })},
+        {"output/unused", mode([](OutputOptions& o) { o.show_unused = true; })},
+        {"output/interpose", mode([](OutputOptions& o) { o.show_interpose = true; })},
+        {"output/footprint", mode([](OutputOptions& o) { o.show_footprint = true; })},
+    }};
+    for (const auto& [name, opt] : modes)
+    {
+        // --pkg-list refuses to run without libalpm; get_minimal_pkgs above covers its work.
+        if (opt.show_pkg_list && !graph.cache->alpm.is_available()) continue;
+        SilencedStdout silence;
+        results.push_back(measure(name, n, [&]
+        {
+            OutputWriter out;
+            print_graph(out, graph, opt);
+        }));
+    }
+
+    // --diff against an empty graph of the same root, so every library shows up as added.
+    const GraphSnapshot before{GraphSnapshot::from_graph(graph).root, {}, {}};
+    {
+        SilencedStdout silence;
+        results.push_back(measure("output/diff", n, [&]
+        {
+            OutputWriter out;
+            print_snapshot_diff(out, before, GraphSnapshot::from_graph(graph), false, false, false);
+        }));
+    }
+
+    return report;
+}
+}
+
+int main(int argc, char** argv)
+{
+    CLI::App app{"inspect-deps-bench: benchmarks on a synthetic ELF dependency tree"};
+
+    BenchConfig cfg;
+    bool keep = false;
+    app.add_option("--depth", cfg.depth, "Levels of libraries below the binary")->check(CLI::PositiveNumber);
+    app.add_option("--width", cfg.width, "Libraries per level")->check(CLI::PositiveNumber);
+    app.add_option("--fanout", cfg.fanout, "DT_NEEDED entries per object")->check(CLI::PositiveNumber);
+    app.add_option("--diamond", cfg.diamond, "Chance a dependency is shared with other parents (0-1)");
+    app.add_option("--origin", cfg.origin, "Fraction of libraries using $ORIGIN search paths (0-1)");
+    app.add_option("--lib-size", cfg.lib_size, "Size of each generated library in bytes");
+    app.add_option("--iterations", cfg.iterations, "Timed runs per benchmark")->check(CLI::PositiveNumber);
+    app.add_option("-j,--jobs", cfg.jobs, "Threads for the parallel build (0 = all cores)");
+    app.add_option("--seed", cfg.seed, "Random seed for the generator");
+    app.add_flag("--keep", keep, "Keep the generated tree and print its location");
+
+    CLI11_PARSE(app, argc, argv);
+
+    std::string tmpl = (fs::temp_directory_path() / "inspect-deps-bench.XXXXXX").string();
+    if (!mkdtemp(tmpl.data()))
+    {
+        std::println(std::cerr, "Error: cannot create temp dir: {}", std::strerror(errno));
+        return 1;
+    }
+    const fs::path dir = tmpl;
+
+    int rc = 0;
+    try
+    {
+        const auto tree = generate_tree(dir, cfg);
+
+        // Non-$ORIGIN libraries are found through LD_LIBRARY_PATH; list the deepest level first
+        // so lookups probe several directories, like a long real-world path would.
+        std::string ld_path;
+        for (const auto& d : tree.lib_dirs | v::reverse) ld_path += (ld_path.empty() ? "" : ":") + d;
+        setenv("LD_LIBRARY_PATH", ld_path.c_str(), 1);
+
+        const auto report = run_benchmarks(tree, cfg);
+        std::string buffer;
+        if (glz::write_json(report, buffer))
+        {
+            std::println(std::cerr, "Error writing JSON");
+            rc = 1;
+        }
+        else
+        {
+            std::println("{}", buffer);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::println(std::cerr, "Error: {}", e.what());
+        rc = 1;
+    }
+
+    if (keep)
+    {
+        std::println(std::cerr, "Synthetic tree kept in {}", dir.string());
+    }
+    else
+    {
+        std::error_code ec;
+        fs::remove_all(dir, ec);
+    }
+    return rc;
+}
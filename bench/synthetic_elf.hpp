@@ -0,0 +1,159 @@
+// Hand-written ELF64 shared objects for the benchmarks and tests (no compiler needed). Include
+// after main.cpp, built with INSPECT_DEPS_NO_MAIN.
+#pragma once
+
+// Just enough of an ELF64 image for the program-header walk: one PT_LOAD mapping the whole
+// file at vaddr 0 (so vaddr == offset), PT_DYNAMIC, the dynamic string table and, when the
+// object has symbols, .dynsym with a DT_HASH table giving its size.
+struct Ehdr64
+{
+    unsigned char e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint64_t e_entry;
+    uint64_t e_phoff;
+    uint64_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+};
+
+struct Phdr64
+{
+    uint32_t p_type;
+    uint32_t p_flags;
+    uint64_t p_offset;
+    uint64_t p_vaddr;
+    uint64_t p_paddr;
+    uint64_t p_filesz;
+    uint64_t p_memsz;
+    uint64_t p_align;
+};
+
+struct Dyn64
+{
+    uint64_t d_tag;
+    uint64_t d_val;
+};
+
+struct Sym64
+{
+    uint32_t st_name;
+    unsigned char st_info;
+    unsigned char st_other;
+    uint16_t st_shndx;
+    uint64_t st_value;
+    uint64_t st_size;
+};
+
+constexpr uint16_t ET_DYN = 3;
+constexpr uint16_t EM_X86_64 = 62;
+constexpr uint16_t EM_PPC64 = 21;
+
+struct SyntheticElf
+{
+    std::vector<std::string> needed;
+    std::string soname;
+    std::string search_path;
+    bool use_rpath = false;
+    // Global functions this object defines and references.
+    std::vector<std::string> exports;
+    std::vector<std::string> imports;
+    size_t min_size = 0;
+    bool big_endian = false;
+    uint16_t machine = EM_X86_64;
+};
+
+inline void write_elf(const fs::path& path, const SyntheticElf& elf)
+{
+    const bool swap = elf.big_endian != (std::endian::native == std::endian::big);
+    auto o = [swap](auto v) { return swap ? std::byteswap(v) : v; };
+
+    std::string strtab(1, '\0');
+    auto add_string = [&](const std::string& s)
+    {
+        const uint64_t off = strtab.size();
+        strtab += s;
+        strtab += '\0';
+        return off;
+    };
+
+    std::vector<Sym64> syms(1, Sym64{});
+    constexpr unsigned char GLOBAL_FUNC = (1 << 4) | 2;
+    for (const auto& name : elf.exports)
+        syms.push_back({o(static_cast<uint32_t>(add_string(name))), GLOBAL_FUNC, 0, o(uint16_t{1}), 0, 0});
+    for (const auto& name : elf.imports)
+        syms.push_back({o(static_cast<uint32_t>(add_string(name))), GLOBAL_FUNC, 0, 0, 0, 0});
+    const bool has_symbols = syms.size() > 1;
+
+    std::vector<Dyn64> dyn;
+    auto add_dyn = [&](int64_t tag, uint64_t value) { dyn.push_back({o(static_cast<uint64_t>(tag)), o(value)}); };
+    for (const auto& n : elf.needed) add_dyn(ELFIO::DT_NEEDED, add_string(n));
+    if (!elf.soname.empty()) add_dyn(ELFIO::DT_SONAME, add_string(elf.soname));
+    if (!elf.search_path.empty())
+        add_dyn(elf.use_rpath ? ELFIO::DT_RPATH : ELFIO::DT_RUNPATH, add_string(elf.search_path));
+
+    // One empty bucket: readers only take the symbol count (nchain) from DT_HASH.
+    std::vector<uint32_t> hash;
+    if (has_symbols)
+    {
+        hash.assign(3 + syms.size(), 0);
+        hash[0] = o(uint32_t{1});
+        hash[1] = o(static_cast<uint32_t>(syms.size()));
+    }
+
+    const uint64_t dyn_off = sizeof(Ehdr64) + 2 * sizeof(Phdr64);
+    const uint64_t dyn_size = (dyn.size() + (has_symbols ? 6 : 3)) * sizeof(Dyn64);
+    const uint64_t sym_off = dyn_off + dyn_size;
+    const uint64_t hash_off = sym_off + (has_symbols ? syms.size() * sizeof(Sym64) : 0);
+    const uint64_t str_off = hash_off + hash.size() * sizeof(uint32_t);
+    if (has_symbols)
+    {
+        add_dyn(ELFIO::DT_SYMTAB, sym_off);
+        add_dyn(ELFIO::DT_SYMENT, sizeof(Sym64));
+        add_dyn(ELFIO::DT_HASH, hash_off);
+    }
+    add_dyn(ELFIO::DT_STRTAB, str_off);
+    add_dyn(ELFIO::DT_STRSZ, strtab.size());
+    add_dyn(ELFIO::DT_NULL, 0);
+    const uint64_t file_size = std::max<uint64_t>(str_off + strtab.size(), elf.min_size);
+
+    Ehdr64 eh{};
+    std::memcpy(eh.e_ident, "\x7f" "ELF", 4);
+    eh.e_ident[ELFIO::EI_CLASS] = ELFIO::ELFCLASS64;
+    eh.e_ident[ELFIO::EI_DATA] = elf.big_endian ? ELFIO::ELFDATA2MSB : ELFIO::ELFDATA2LSB;
+    eh.e_ident[6] = 1;
+    eh.e_type = o(ET_DYN);
+    eh.e_machine = o(elf.machine);
+    eh.e_version = o(uint32_t{1});
+    eh.e_phoff = o(static_cast<uint64_t>(sizeof(Ehdr64)));
+    eh.e_ehsize = o(static_cast<uint16_t>(sizeof(Ehdr64)));
+    eh.e_phentsize = o(static_cast<uint16_t>(sizeof(Phdr64)));
+    eh.e_phnum = o(uint16_t{2});
+
+    const Phdr64 phdrs[2] = {
+        {o(uint32_t{ELFIO::PT_LOAD}), o(uint32_t{4}), 0, 0, 0, o(file_size), o(file_size), o(uint64_t{0x1000})},
+        {o(uint32_t{ELFIO::PT_DYNAMIC}), o(uint32_t{6}), o(dyn_off), o(dyn_off), o(dyn_off), o(dyn_size), o(dyn_size),
+         o(uint64_t{8})}
+    };
+
+    std::string image(file_size, '\0');
+    std::memcpy(image.data(), &eh, sizeof(eh));
+    std::memcpy(image.data() + sizeof(eh), phdrs, sizeof(phdrs));
+    std::memcpy(image.data() + dyn_off, dyn.data(), dyn.size() * sizeof(Dyn64));
+    if (has_symbols)
+    {
+        std::memcpy(image.data() + sym_off, syms.data(), syms.size() * sizeof(Sym64));
+        std::memcpy(image.data() + hash_off, hash.data(), hash.size() * sizeof(uint32_t));
+    }
+    std::memcpy(image.data() + str_off, strtab.data(), strtab.size());
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(image.data(), static_cast<std::streamsize>(image.size()));
+    if (!out) throw std::runtime_error("cannot write " + path.string());
+}
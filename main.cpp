@@ -1,7 +1,9 @@
 #include <print>
+#include <format>
 #include <vector>
 #include <string>
 #include <map>
+#include <set>
 #include <unordered_map>
 #include <unordered_set>
 #include <array>
@@ -9,18 +11,41 @@
 #include <filesystem>
 #include <fstream>
 #include <algorithm>
+#include <numeric>
+#include <limits>
 #include <optional>
 #include <ranges>
 #include <span>
+#include <spanstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <ctime>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <dirent.h>
 #include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
 
 #include <CLI/CLI.hpp>
 #include <glaze/glaze.hpp>
 #include <elfio/elfio.hpp>
 #include <dlfcn.h>
+#include <poll.h>
+#include <csignal>
+#include <stdio_ext.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
 
 namespace fs = std::filesystem;
 namespace r = std::ranges;
@@ -76,955 +101,6793 @@ typedef alpm_filelist_t* (*alpm_pkg_get_files_fn)(alpm_pkg_t*);
 typedef const char* (*alpm_pkg_get_name_fn)(alpm_pkg_t*);
 }
 
-class LdCache
+// Instrumentation behind --stats and --trace. Counters and phase scopes do nothing until
+// start() enables them, so they can stay on hot paths.
+class Stats
 {
-    struct HeaderNew
+public:
+    enum Counter
     {
-        char magic[20];
-        uint32_t nlibs;
-        uint32_t len_strings;
-        uint32_t unused[5];
+        FILES_PARSED,
+        BYTES_MAPPED,
+        STAT_CALLS,
+        DIRS_LISTED,
+        DISK_CACHE_HITS,
+        DISK_CACHE_MISSES,
+        PARSE_CACHE_HITS,
+        PARSE_CACHE_MISSES,
+        RESOLVE_CACHE_HITS,
+        RESOLVE_CACHE_MISSES,
+        PACKAGES_SCANNED,
+        COUNTER_COUNT
     };
 
-    struct EntryNew
+    enum Phase
     {
-        int32_t flags;
-        uint32_t key;
-        uint32_t value;
-        uint32_t osversion;
-        uint64_t hwcap;
+        IMAGE_INDEX,
+        LD_CACHE,
+        ALPM_INIT,
+        PKG_INDEX,
+        RDEPS_INDEX,
+        PREFETCH,
+        WALK,
+        PARSE,
+        SYMBOLS,
+        RESOLVE,
+        PACKAGES,
+        CACHE_SAVE,
+        OUTPUT,
+        PHASE_COUNT
     };
 
-    std::unordered_map<std::string_view, std::string_view> cache;
-    void* mmap_addr = MAP_FAILED;
-    size_t mmap_size = 0;
+private:
+    static constexpr std::array<std::string_view, COUNTER_COUNT> COUNTER_NAMES = {
+        "files parsed", "bytes mapped", "stat calls", "dirs listed", "disk cache hits", "disk cache misses",
+        "parse cache hits", "parse cache misses", "resolve cache hits", "resolve cache misses", "packages scanned"
+    };
+    static constexpr std::array<std::string_view, PHASE_COUNT> PHASE_NAMES = {
+        "image index", "ld.so.cache", "alpm init", "package index", "reverse index", "prefetch", "walk", "parse",
+        "symbols", "resolve", "packages", "cache save", "output"
+    };
 
-public:
-    LdCache()
+    struct PhaseTotals
     {
-        const int fd = open("/etc/ld.so.cache", O_RDONLY);
-        if (fd == -1) return;
-
-        struct stat st{};
-        if (fstat(fd, &st) == 0)
-        {
-            mmap_size = st.st_size;
-            mmap_addr = mmap(nullptr, mmap_size, PROT_READ, MAP_PRIVATE, fd, 0);
-        }
-        close(fd);
-
-        if (mmap_addr == MAP_FAILED) return;
+        std::atomic<uint64_t> calls;
+        std::atomic<uint64_t> wall_ns;
+        std::atomic<uint64_t> cpu_ns;
+    };
 
-        if (mmap_size < sizeof(HeaderNew)) return;
-        auto* header = static_cast<HeaderNew*>(mmap_addr);
+    // Chrome trace-event format ("X" = complete event, times in microseconds).
+    struct TraceEvent
+    {
+        std::string name;
+        std::string cat;
+        std::string ph;
+        uint64_t ts;
+        uint64_t dur;
+        int pid;
+        uint32_t tid;
+        std::map<std::string, std::string> args;
+    };
 
-        std::string_view magic(header->magic, 17);
-        if (magic == "glibc-ld.so.cache" && header->magic[17] == '1')
-        {
-            size_t offset_strings = sizeof(HeaderNew) + header->nlibs * sizeof(EntryNew);
-            if (offset_strings > mmap_size) return;
+    struct TraceFile
+    {
+        std::vector<TraceEvent> traceEvents;
+        std::string displayTimeUnit;
+    };
 
-            auto base_addr = static_cast<const char*>(mmap_addr);
-            const auto entries_span = std::span(
-                reinterpret_cast<EntryNew*>(static_cast<char*>(mmap_addr) + sizeof(HeaderNew)),
-                header->nlibs
-            );
+    inline static bool enabled = false;
+    inline static bool tracing = false;
+    inline static uint64_t wall_epoch = 0;
+    inline static uint64_t cpu_epoch = 0;
+    inline static std::array<std::atomic<uint64_t>, COUNTER_COUNT> counters{};
+    inline static std::array<PhaseTotals, PHASE_COUNT> phases;
+    inline static std::mutex trace_mutex;
+    inline static std::vector<TraceEvent> events;
 
-            for (const auto& entry : entries_span)
-            {
-                if (entry.key >= mmap_size || entry.value >= mmap_size) continue;
-                cache.emplace(base_addr + entry.key, base_addr + entry.value);
-            }
-        }
+    static uint64_t now_ns(clockid_t clock)
+    {
+        timespec ts{};
+        clock_gettime(clock, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
     }
 
-    LdCache(const LdCache&) = delete;
-    LdCache& operator=(const LdCache&) = delete;
-
-    ~LdCache()
+    static uint32_t thread_id()
     {
-        if (mmap_addr != MAP_FAILED) munmap(mmap_addr, mmap_size);
+        static std::atomic<uint32_t> next{0};
+        thread_local const uint32_t id = next++;
+        return id;
     }
 
-    std::optional<std::string> resolve(const std::string& soname)
+public:
+    // Resets all totals; called once per command line (the daemon runs many).
+    static void start(bool stats, bool trace)
     {
-        if (const auto it = cache.find(soname); it != cache.end())
+        enabled = stats || trace;
+        tracing = trace;
+        for (auto& c : counters) c.store(0, std::memory_order_relaxed);
+        for (auto& p : phases)
         {
-            return std::string(it->second);
+            p.calls.store(0, std::memory_order_relaxed);
+            p.wall_ns.store(0, std::memory_order_relaxed);
+            p.cpu_ns.store(0, std::memory_order_relaxed);
         }
-        return std::nullopt;
+        std::lock_guard lock(trace_mutex);
+        events.clear();
+        wall_epoch = now_ns(CLOCK_MONOTONIC);
+        cpu_epoch = now_ns(CLOCK_PROCESS_CPUTIME_ID);
     }
-};
-
-class AlpmManager
-{
-    void* lib_handle = nullptr;
-    alpm_handle_t* handle = nullptr;
-    alpm_db_t* db_local = nullptr;
-    std::unordered_map<std::string, std::string> pkg_cache;
-    bool initialized = false;
-
-    // Function pointers
-    alpm_initialize_fn _alpm_initialize = nullptr;
-    alpm_release_fn _alpm_release = nullptr;
-    alpm_get_localdb_fn _alpm_get_localdb = nullptr;
-    alpm_strerror_fn _alpm_strerror = nullptr;
-    alpm_db_get_pkgcache_fn _alpm_db_get_pkgcache = nullptr;
-    alpm_list_next_fn _alpm_list_next = nullptr;
-    alpm_pkg_get_files_fn _alpm_pkg_get_files = nullptr;
-    alpm_pkg_get_name_fn _alpm_pkg_get_name = nullptr;
 
-    template <typename T>
-    static T sym(void* handle, const char* name)
+    static void count(Counter c, uint64_t n = 1)
     {
-        return reinterpret_cast<T>(dlsym(handle, name));
+        if (enabled) counters[c].fetch_add(n, std::memory_order_relaxed);
     }
 
-public:
-    AlpmManager()
+    // Adds its wall and thread CPU time to a phase; with tracing on, also records an event
+    // (`detail`, e.g. the file being parsed, becomes its "path" argument).
+    class Scope
     {
-        lib_handle = dlopen("libalpm.so", RTLD_LAZY);
-        if (!lib_handle)
-        {
-            lib_handle = dlopen("libalpm.so.13", RTLD_LAZY);
-        }
-        if (!lib_handle)
+        Phase phase;
+        bool active;
+        uint64_t wall_start = 0;
+        uint64_t cpu_start = 0;
+        std::string detail;
+
+    public:
+        explicit Scope(Phase p, std::string_view what = {}) : phase(p), active(enabled)
         {
-            lib_handle = dlopen("libalpm.so.14", RTLD_LAZY);
+            if (!active) return;
+            if (tracing) detail = what;
+            wall_start = now_ns(CLOCK_MONOTONIC);
+            cpu_start = now_ns(CLOCK_THREAD_CPUTIME_ID);
         }
 
-        if (!lib_handle) return;
-
-        _alpm_initialize = sym<alpm_initialize_fn>(lib_handle, "alpm_initialize");
-        _alpm_release = sym<alpm_release_fn>(lib_handle, "alpm_release");
-        _alpm_get_localdb = sym<alpm_get_localdb_fn>(lib_handle, "alpm_get_localdb");
-        _alpm_strerror = sym<alpm_strerror_fn>(lib_handle, "alpm_strerror");
-        _alpm_db_get_pkgcache = sym<alpm_db_get_pkgcache_fn>(lib_handle, "alpm_db_get_pkgcache");
-        _alpm_list_next = sym<alpm_list_next_fn>(lib_handle, "alpm_list_next");
-        _alpm_pkg_get_files = sym<alpm_pkg_get_files_fn>(lib_handle, "alpm_pkg_get_files");
-        _alpm_pkg_get_name = sym<alpm_pkg_get_name_fn>(lib_handle, "alpm_pkg_get_name");
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
 
-        if (!_alpm_initialize || !_alpm_release || !_alpm_get_localdb || !_alpm_strerror ||
-            !_alpm_db_get_pkgcache || !_alpm_list_next || !_alpm_pkg_get_files || !_alpm_pkg_get_name)
+        ~Scope()
         {
-            std::println(std::cerr, "Failed to load ALPM symbols.");
-            dlclose(lib_handle);
-            lib_handle = nullptr;
-            return;
+            if (!active) return;
+            const uint64_t wall = now_ns(CLOCK_MONOTONIC) - wall_start;
+            auto& totals = phases[phase];
+            totals.calls.fetch_add(1, std::memory_order_relaxed);
+            totals.wall_ns.fetch_add(wall, std::memory_order_relaxed);
+            totals.cpu_ns.fetch_add(now_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start, std::memory_order_relaxed);
+            if (!tracing) return;
+
+            TraceEvent ev{
+                std::string(PHASE_NAMES[phase]), "inspect-deps", "X",
+                (wall_start - wall_epoch) / 1000, wall / 1000, getpid(), thread_id(), {}
+            };
+            if (!detail.empty()) ev.args["path"] = std::move(detail);
+            std::lock_guard lock(trace_mutex);
+            events.push_back(std::move(ev));
         }
+    };
 
-        alpm_errno_t err;
-        handle = _alpm_initialize("/", "/var/lib/pacman", &err);
-        if (handle)
+    // Phases nest (parse and resolve run inside prefetch/walk) and are summed over threads,
+    // so with --jobs they can add up to more than the total.
+    static void print_report()
+    {
+        const auto ms = [](uint64_t ns) { return static_cast<double>(ns) / 1e6; };
+        std::println(std::cerr, "{:<16} {:>8} {:>12} {:>12}", "Phase", "Calls", "Wall ms", "CPU ms");
+        for (size_t i = 0; i < PHASE_COUNT; ++i)
         {
-            db_local = _alpm_get_localdb(handle);
-            initialized = true;
+            const auto& p = phases[i];
+            if (p.calls == 0) continue;
+            std::println(std::cerr, "{:<16} {:>8} {:>12.3f} {:>12.3f}", PHASE_NAMES[i], p.calls.load(),
+                         ms(p.wall_ns), ms(p.cpu_ns));
         }
-        else
+        std::println(std::cerr, "{:<16} {:>8} {:>12.3f} {:>12.3f}", "total", "",
+                     ms(now_ns(CLOCK_MONOTONIC) - wall_epoch), ms(now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_epoch));
+        std::println(std::cerr, "");
+        std::println(std::cerr, "{:<22} {:>12}", "Counter", "Value");
+        for (size_t i = 0; i < COUNTER_COUNT; ++i)
         {
-            std::println(std::cerr, "Failed to initialize alpm: {}", _alpm_strerror(err));
+            std::println(std::cerr, "{:<22} {:>12}", COUNTER_NAMES[i], counters[i].load());
         }
     }
 
-    AlpmManager(const AlpmManager&) = delete;
-    AlpmManager& operator=(const AlpmManager&) = delete;
-
-    ~AlpmManager()
+    static bool write_trace(const std::string& path)
     {
-        if (handle && _alpm_release) _alpm_release(handle);
-        if (lib_handle) dlclose(lib_handle);
+        TraceFile file;
+        {
+            std::lock_guard lock(trace_mutex);
+            file.traceEvents = events;
+        }
+        file.displayTimeUnit = "ms";
+
+        std::string buffer;
+        if (glz::write_json(file, buffer)) return false;
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << buffer << '\n';
+        return static_cast<bool>(out);
     }
+};
 
-    void batch_resolve(const std::vector<std::string>& paths)
+// A container image given as tar layers (OCI or Docker layer blobs: plain, or gzip/zstd through
+// the system decompressor), indexed in one pass over each layer's member headers instead of
+// being extracted. Layers apply bottom first with the OCI whiteout rules: ".wh.NAME" hides NAME
+// in the layers below and ".wh..wh..opq" hides everything below in its directory. Member data
+// is served straight from the layer mappings.
+class ImageArchive
+{
+public:
+    // Entry names of one directory with their dirent d_type.
+    using Listing = std::vector<std::pair<std::string, unsigned char>>;
+
+private:
+    struct Node
     {
-        if (!initialized || !db_local) return;
+        mode_t mode = S_IFDIR | 0755;
+        uint32_t layer = 0;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        std::string link;
+    };
 
-        std::vector<std::string> to_find;
-        for (const auto& p : paths)
-        {
-            if (!pkg_cache.contains(p)) to_find.push_back(p);
-        }
-        if (to_find.empty()) return;
+    struct Layer
+    {
+        void* addr = MAP_FAILED;
+        size_t size = 0;
+    };
 
-        std::unordered_map<std::string, std::string> lookup_map;
-        for (const auto& p : to_find)
-        {
-            if (p.starts_with('/'))
-            {
-                lookup_map[p.substr(1)] = p;
-            }
-            else
-            {
-                lookup_map[p] = p;
-            }
-        }
+    // Names and sizes from GNU long-name and pax headers, for the member that follows them.
+    struct Pending
+    {
+        std::optional<std::string> name;
+        std::optional<std::string> link;
+        std::optional<uint64_t> size;
+    };
 
-        const alpm_list_t* pkg_cache_list = _alpm_db_get_pkgcache(db_local);
-        for (const alpm_list_t* i = pkg_cache_list; i; i = _alpm_list_next(i))
-        {
-            auto* pkg = static_cast<alpm_pkg_t*>(i->data);
-            const alpm_filelist_t* files = _alpm_pkg_get_files(pkg);
+    struct Member
+    {
+        std::string path;
+        Node node;
+        std::optional<std::string> hardlink;
+    };
 
-            for (size_t f = 0; f < files->count; ++f)
-            {
-                const char* filename = files->files[f].name;
-                if (auto it = lookup_map.find(filename); it != lookup_map.end())
-                {
-                    pkg_cache[it->second] = _alpm_pkg_get_name(pkg);
-                    lookup_map.erase(it);
-                    if (lookup_map.empty()) return;
-                }
-            }
-        }
+    // Compressed blobs are recognized by their leading bytes and piped through `tool -dc`.
+    struct Codec
+    {
+        std::string_view magic;
+        const char* tool;
+    };
+
+    static constexpr std::array<Codec, 2> CODECS = {{
+        {{"\x1f\x8b", 2}, "gzip"},
+        {{"\x28\xb5\x2f\xfd", 4}, "zstd"},
+    }};
+    static constexpr uint64_t BLOCK = 512;
+    static constexpr int MAX_LINKS = 40;
+    static constexpr std::string_view WHITEOUT = ".wh.";
+    static constexpr std::string_view OPAQUE = ".wh..wh..opq";
+    // st_dev of every member; identities are only compared within one image.
+    static constexpr dev_t DEVICE = static_cast<dev_t>(-1);
+
+    std::vector<Layer> layers;
+    std::vector<Node> nodes;
+    // Image path without the leading '/' -> node; "" is the root. Hard links share a node.
+    std::map<std::string, uint32_t> paths;
+    std::unordered_map<std::string, Listing> dirs;
+
+    ImageArchive() = default;
+
+    static std::string parent(std::string_view path)
+    {
+        const auto slash = path.rfind('/');
+        return slash == std::string_view::npos ? std::string() : std::string(path.substr(0, slash));
     }
 
-    std::string get_package(const std::string& path)
+    static std::string_view text(const char* field, size_t len)
     {
-        if (const auto it = pkg_cache.find(path); it != pkg_cache.end())
+        return {field, strnlen(field, len)};
+    }
+
+    // Octal, or GNU base-256 when the high bit of the first byte is set.
+    static uint64_t number(const char* field, size_t len)
+    {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(field);
+        uint64_t value = 0;
+        if (bytes[0] & 0x80)
         {
-            return it->second;
+            value = bytes[0] & 0x7f;
+            for (size_t i = 1; i < len; ++i) value = (value << 8) | bytes[i];
+            return value;
         }
-        return "-";
+        size_t i = 0;
+        while (i < len && bytes[i] == ' ') ++i;
+        for (; i < len && bytes[i] >= '0' && bytes[i] <= '7'; ++i) value = value * 8 + (bytes[i] - '0');
+        return value;
     }
 
-    bool is_available() const { return initialized; }
-};
+    // The checksum field counts as eight spaces.
+    static bool checksum_ok(const char* header)
+    {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(header);
+        uint64_t sum = 0;
+        for (size_t i = 0; i < BLOCK; ++i) sum += (i >= 148 && i < 156) ? ' ' : bytes[i];
+        return sum == number(header + 148, 8);
+    }
 
-struct Node
-{
-    std::string path;
-    std::string pkg;
-    int depth = 0;
-    std::vector<std::string> children;
-    std::vector<std::string> parents;
-};
+    // ustar splits long names into prefix and name; GNU tar uses the prefix bytes for other fields.
+    static std::string member_name(const char* header)
+    {
+        const auto name = text(header, 100);
+        const auto prefix = text(header + 345, 155);
+        if (std::string_view(header + 257, 6) != std::string_view("ustar\0", 6) || prefix.empty())
+            return std::string(name);
+        return std::format("{}/{}", prefix, name);
+    }
 
-std::vector<std::string> split_path(std::string_view s)
-{
-    if (s.empty()) return {};
-    return s | v::split(':')
-        | v::transform([](auto&& rng)
+    // Member name as an image path without leading or trailing '/'; nullopt for names that
+    // climb out of the root.
+    static std::optional<std::string> normalize(std::string_view name)
+    {
+        std::string out;
+        for (const auto part : name | v::split('/'))
         {
-            auto str = std::string(rng.begin(), rng.end());
-            return str.empty() ? "." : str;
-        })
-        | r::to<std::vector<std::string>>();
-}
-
-struct DepGraph
-{
-    std::unordered_map<std::string, Node> nodes;
-    std::string root_name;
-    LdCache ld_cache;
-    AlpmManager alpm;
-    std::vector<std::string> ld_paths;
+            const std::string_view p(part.begin(), part.end());
+            if (p.empty() || p == ".") continue;
+            if (p == "..") return std::nullopt;
+            if (!out.empty()) out += '/';
+            out += p;
+        }
+        return out;
+    }
 
-    std::optional<std::string> resolve_library(
-        const std::string& name,
-        const std::vector<std::string>& rpaths,
-        const std::vector<std::string>& runpaths,
-        const std::vector<std::string>& inherited_rpaths)
+    // Records of a pax extended header: "LEN KEY=VALUE\n", LEN counting the whole record.
+    static void read_pax(std::string_view data, Pending& pending)
     {
-        std::vector<std::string> search_paths;
-
-        // 1. RPATH (if no RUNPATH)
-        if (runpaths.empty())
+        while (!data.empty())
         {
-            search_paths.append_range(rpaths);
-            search_paths.append_range(inherited_rpaths);
+            size_t len = 0;
+            size_t i = 0;
+            while (i < data.size() && data[i] >= '0' && data[i] <= '9') len = len * 10 + (data[i++] - '0');
+            if (i == 0 || i >= data.size() || data[i] != ' ' || len < i + 2 || len > data.size()) return;
+            const auto record = data.substr(i + 1, len - i - 2);
+            data.remove_prefix(len);
+
+            const auto eq = record.find('=');
+            if (eq == std::string_view::npos) continue;
+            const auto key = record.substr(0, eq);
+            const auto value = record.substr(eq + 1);
+            if (key == "path") pending.name = std::string(value);
+            else if (key == "linkpath") pending.link = std::string(value);
+            else if (key == "size")
+            {
+                uint64_t size = 0;
+                for (const char c : value) size = size * 10 + (c - '0');
+                pending.size = size;
+            }
         }
+    }
 
-        // 2. LD_LIBRARY_PATH
-        search_paths.append_range(ld_paths);
+    // An unlinked file in $TMPDIR, or /var/tmp (rarely tmpfs, unlike /tmp), to hold a decompressed
+    // layer: its pages are file-backed and can be dropped under pressure instead of pinned in RAM.
+    static int spill_file()
+    {
+        const char* env = std::getenv("TMPDIR");
+        const std::string dir = env && *env ? env : "/var/tmp";
+        const int fd = ::open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+        if (fd != -1 || (errno != EOPNOTSUPP && errno != EISDIR)) return fd;
+
+        std::string name = dir + "/inspect-deps.XXXXXX";
+        const int tmp = mkostemp(name.data(), O_CLOEXEC);
+        if (tmp != -1) unlink(name.c_str());
+        return tmp;
+    }
 
-        // 3. RUNPATH
-        search_paths.append_range(runpaths);
+    // Runs `tool -dc` with the blob on stdin and a spill file on stdout.
+    static int decompress(int fd, const char* tool)
+    {
+        const int out = spill_file();
+        if (out == -1) return -1;
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, fd, STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+        char* argv[] = {const_cast<char*>(tool), const_cast<char*>("-dc"), nullptr};
+        pid_t pid = 0;
+        int status = 0;
+        const bool ok = posix_spawnp(&pid, tool, &actions, nullptr, argv, environ) == 0 &&
+                        waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        posix_spawn_file_actions_destroy(&actions);
+        if (ok) return out;
+        close(out);
+        return -1;
+    }
 
-        for (const auto& dir : search_paths)
+    static std::optional<Layer> map_layer(const std::string& path, std::string& error)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
         {
-            fs::path p = fs::path(dir) / name;
-            if (fs::exists(p)) return fs::canonical(p).string();
+            error = std::strerror(errno);
+            return std::nullopt;
         }
 
-        // 4. LdCache
-        if (auto res = ld_cache.resolve(name)) return *res;
+        char head[4]{};
+        const ssize_t got = pread(fd, head, sizeof(head), 0);
+        for (const auto& codec : CODECS)
+        {
+            if (got < static_cast<ssize_t>(codec.magic.size()) || std::string_view(head, codec.magic.size()) != codec.magic)
+                continue;
+            const int plain = decompress(fd, codec.tool);
+            close(fd);
+            if (plain == -1)
+            {
+                error = std::format("cannot decompress with {}", codec.tool);
+                return std::nullopt;
+            }
+            fd = plain;
+            break;
+        }
 
-        // 5. Default paths
-        constexpr std::array<std::string_view, 4> defaults = {"/lib", "/usr/lib", "/lib64", "/usr/lib64"};
-        for (const auto& dir : defaults)
+        Layer layer;
+        struct stat st{};
+        Stats::count(Stats::STAT_CALLS);
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            layer.size = st.st_size;
+            layer.addr = mmap(nullptr, layer.size, PROT_READ, MAP_PRIVATE, fd, 0);
+            Stats::count(Stats::BYTES_MAPPED, layer.size);
+        }
+        close(fd);
+        if (layer.addr == MAP_FAILED)
         {
-            fs::path p = fs::path(dir) / name;
-            if (fs::exists(p)) return fs::canonical(p).string();
+            error = "empty or unreadable layer";
+            return std::nullopt;
         }
+        return layer;
+    }
 
-        return std::nullopt;
+    // Drops everything below `dir` (all of the image for "").
+    void erase_below(const std::string& dir)
+    {
+        const std::string prefix = dir.empty() ? dir : dir + '/';
+        auto it = paths.lower_bound(prefix);
+        while (it != paths.end() && it->first.starts_with(prefix)) it = paths.erase(it);
     }
 
-    void build(const std::string& root_path, bool show_stdlib, bool resolve_packages = true)
+    // One pass over the member headers of a layer; member data is skipped, not read. Whiteouts
+    // apply to the layers below, so they take effect before this layer's members are added.
+    bool index_layer(uint32_t index, std::string& error)
     {
-        if (const char* env_p = std::getenv("LD_LIBRARY_PATH"))
+        const auto* data = static_cast<const char*>(layers[index].addr);
+        const uint64_t size = layers[index].size;
+
+        std::vector<Member> members;
+        std::vector<std::string> hidden;
+        std::vector<std::string> opaque;
+        Pending pending;
+        uint64_t off = 0;
+        while (size - off >= BLOCK)
         {
-            std::string origin = fs::path(root_path).parent_path().string();
-            for (auto p : split_path(env_p))
+            const char* header = data + off;
+            if (std::all_of(header, header + BLOCK, [](char c) { return c == '\0'; })) break;
+            if (!checksum_ok(header))
             {
-                size_t pos = 0;
-                while ((pos = p.find("$ORIGIN", pos)) != std::string::npos)
-                {
-                    p.replace(pos, 7, origin);
-                    pos += origin.length();
-                }
-                ld_paths.push_back(p);
+                error = off == 0 ? "not a tar archive" : std::format("bad header at offset {}", off);
+                return false;
             }
-        }
 
-        root_name = fs::path(root_path).filename().string();
-        nodes[root_name] = {root_path, "", 0, {}, {}};
+            const uint64_t start = off + BLOCK;
+            const uint64_t length = pending.size.value_or(number(header + 124, 12));
+            if (length > size - start)
+            {
+                error = std::format("truncated member at offset {}", off);
+                return false;
+            }
+            off = std::min(size, start + (length + BLOCK - 1) / BLOCK * BLOCK);
 
-        struct WorkItem
-        {
-            std::string name;
-            std::vector<std::string> inherited_rpaths;
+            const char type = header[156];
+            const std::string_view payload(data + start, length);
+            if (type == 'L' || type == 'K')
+            {
+                (type == 'L' ? pending.name : pending.link) = std::string(text(payload.data(), payload.size()));
+                continue;
+            }
+            if (type == 'x')
+            {
+                read_pax(payload, pending);
+                continue;
+            }
+            if (type == 'g') continue;
+
+            const auto raw = pending.name.value_or(member_name(header));
+            const auto link = pending.link.value_or(std::string(text(header + 157, 100)));
+            pending = {};
+
+            auto path = normalize(raw);
+            if (!path || path->empty()) continue;
+
+            const auto dir = parent(*path);
+            const std::string_view name = std::string_view(*path).substr(dir.empty() ? 0 : dir.size() + 1);
+            if (name == OPAQUE)
+            {
+                opaque.push_back(dir);
+                continue;
+            }
+            if (name.starts_with(WHITEOUT))
+            {
+                const auto target = name.substr(WHITEOUT.size());
+                hidden.push_back(dir.empty() ? std::string(target) : std::format("{}/{}", dir, target));
+                continue;
+            }
+
+            Member m{std::move(*path), {}, std::nullopt};
+            m.node.layer = index;
+            m.node.offset = start;
+            m.node.size = length;
+            m.node.mtime = static_cast<int64_t>(number(header + 136, 12));
+            const auto perm = static_cast<mode_t>(number(header + 100, 8) & 07777);
+            switch (type)
+            {
+            case '0':
+            case '\0':
+            case '7':
+                m.node.mode = (raw.ends_with('/') ? S_IFDIR : S_IFREG) | perm;
+                break;
+            case '1':
+                m.hardlink = normalize(link);
+                if (!m.hardlink) continue;
+                break;
+            case '2':
+                m.node.mode = S_IFLNK | 0777;
+                m.node.size = link.size();
+                m.node.link = link;
+                break;
+            case '5':
+                m.node.mode = S_IFDIR | perm;
+                m.node.size = 0;
+                break;
+            default:
+                // Devices and FIFOs can't be loaded.
+                continue;
+            }
+            members.push_back(std::move(m));
+        }
+
+        for (const auto& dir : opaque) erase_below(dir);
+        for (const auto& path : hidden)
+        {
+            paths.erase(path);
+            erase_below(path);
+        }
+        for (auto& m : members)
+        {
+            uint32_t id = 0;
+            if (m.hardlink)
+            {
+                const auto it = paths.find(*m.hardlink);
+                if (it == paths.end()) continue;
+                id = it->second;
+            }
+            else
+            {
+                id = static_cast<uint32_t>(nodes.size());
+                nodes.push_back(std::move(m.node));
+            }
+            if (!S_ISDIR(nodes[id].mode)) erase_below(m.path);
+            paths.insert_or_assign(std::move(m.path), id);
+        }
+        return true;
+    }
+
+    // Adds the directories that only show up as parents of other members, then lists them all.
+    void index_directories()
+    {
+        auto add_dir = [&](const std::string& path)
+        {
+            paths.emplace(path, static_cast<uint32_t>(nodes.size()));
+            nodes.emplace_back();
         };
+        add_dir("");
+        for (const auto& [path, id] : paths)
+        {
+            for (auto dir = parent(path); !paths.contains(dir); dir = parent(dir)) add_dir(dir);
+        }
 
-        std::vector<WorkItem> stack;
-        stack.push_back({root_name, {}});
+        for (const auto& [path, id] : paths)
+        {
+            if (path.empty()) continue;
+            const auto dir = parent(path);
+            // Left below a member that is no longer a directory: unreachable.
+            if (!S_ISDIR(nodes[paths.at(dir)].mode)) continue;
+
+            const mode_t mode = nodes[id].mode;
+            const unsigned char type = S_ISDIR(mode) ? DT_DIR : S_ISLNK(mode) ? DT_LNK : DT_REG;
+            dirs[dir].emplace_back(path.substr(dir.empty() ? 0 : dir.size() + 1), type);
+        }
+    }
+
+    std::string_view bytes(const Node& n) const
+    {
+        return {static_cast<const char*>(layers[n.layer].addr) + n.offset, n.size};
+    }
+
+public:
+    ImageArchive(const ImageArchive&) = delete;
+    ImageArchive& operator=(const ImageArchive&) = delete;
+
+    ~ImageArchive()
+    {
+        for (const auto& l : layers) munmap(l.addr, l.size);
+    }
+
+    // Indexes `layer_paths`, bottom layer first. Failures are reported on stderr.
+    static std::unique_ptr<ImageArchive> open(const std::vector<std::string>& layer_paths)
+    {
+        Stats::Scope scope(Stats::IMAGE_INDEX);
+        std::unique_ptr<ImageArchive> image(new ImageArchive());
+        for (const auto& path : layer_paths)
+        {
+            std::string error;
+            auto layer = map_layer(path, error);
+            if (layer) image->layers.push_back(*layer);
+            if (!layer || !image->index_layer(static_cast<uint32_t>(image->layers.size() - 1), error))
+            {
+                std::println(std::cerr, "Error: {}: {}.", path, error);
+                return nullptr;
+            }
+        }
+        image->index_directories();
+        return image;
+    }
+
+    // Canonical form of an image path (leading '/' optional): symlinks are followed the way
+    // RESOLVE_IN_ROOT follows them, so absolute targets and ".." stay inside the image.
+    std::optional<std::string> resolve(std::string_view path) const
+    {
+        std::vector<std::string> todo;
+        auto push = [&](std::string_view p)
+        {
+            auto parts = p | v::split('/') | v::transform([](auto&& part) { return std::string(part.begin(), part.end()); })
+                | r::to<std::vector<std::string>>();
+            todo.append_range(parts | v::reverse);
+        };
+        push(path);
+
+        std::string cur;
+        int links = 0;
+        while (!todo.empty())
+        {
+            const auto part = std::move(todo.back());
+            todo.pop_back();
+            if (part.empty() || part == ".") continue;
+            if (part == "..")
+            {
+                cur = parent(cur);
+                continue;
+            }
+
+            auto next = cur.empty() ? part : std::format("{}/{}", cur, part);
+            const auto it = paths.find(next);
+            if (it == paths.end()) return std::nullopt;
+            const Node& n = nodes[it->second];
+            if (S_ISLNK(n.mode))
+            {
+                if (++links > MAX_LINKS) return std::nullopt;
+                if (n.link.starts_with('/')) cur.clear();
+                push(n.link);
+                continue;
+            }
+            if (!todo.empty() && !S_ISDIR(n.mode)) return std::nullopt;
+            cur = std::move(next);
+        }
+        return cur;
+    }
+
+    // Metadata of a canonical member; st_ino numbers the file, so hard links share it.
+    bool stat(const std::string& path, struct stat& st) const
+    {
+        const auto it = paths.find(path);
+        if (it == paths.end()) return false;
+        const Node& n = nodes[it->second];
+        st = {};
+        st.st_dev = DEVICE;
+        st.st_ino = it->second + 1;
+        st.st_mode = n.mode;
+        st.st_nlink = 1;
+        st.st_size = static_cast<off_t>(n.size);
+        st.st_mtim.tv_sec = n.mtime;
+        return true;
+    }
+
+    const Listing* list(const std::string& dir) const
+    {
+        const auto it = dirs.find(dir);
+        return it == dirs.end() ? nullptr : &it->second;
+    }
+
+    // Data of a canonical regular member; empty for anything else.
+    std::string_view contents(const std::string& path) const
+    {
+        const auto it = paths.find(path);
+        if (it == paths.end() || !S_ISREG(nodes[it->second].mode)) return {};
+        return bytes(nodes[it->second]);
+    }
+
+    // Regular members below a canonical directory that start with the ELF magic, by path.
+    std::vector<std::string> elf_files(const std::string& dir) const
+    {
+        std::vector<std::string> out;
+        const std::string prefix = dir.empty() ? dir : dir + '/';
+        for (auto it = paths.lower_bound(prefix); it != paths.end() && it->first.starts_with(prefix); ++it)
+        {
+            const Node& n = nodes[it->second];
+            if (S_ISREG(n.mode) && bytes(n).starts_with("\x7f" "ELF")) out.push_back(it->first);
+        }
+        return out;
+    }
+};
+
+// --sysroot: an image under which absolute lookups (ld.so.cache, default directories,
+// RPATH/RUNPATH, the pacman DB) happen. Graph paths stay host paths with the root as prefix.
+// An extracted root is canonicalized through openat2(RESOLVE_IN_ROOT) on a descriptor for it,
+// so absolute symlinks and ".." inside the image never lead out of it; everything downstream
+// then only sees symlink-free paths below the root. Tar layers are answered from an
+// ImageArchive index under the same rules.
+class Sysroot
+{
+    static inline std::string root;
+    static inline int root_fd = -1;
+    static inline std::unique_ptr<ImageArchive> archive;
+
+    // Part of `host_path` below the root, or nullopt if it lies outside.
+    static std::optional<std::string> relative(std::string_view host_path)
+    {
+        if (!host_path.starts_with(root)) return std::nullopt;
+        auto rest = host_path.substr(root.size());
+        if (!rest.empty() && rest.front() != '/') return std::nullopt;
+        while (rest.starts_with('/')) rest.remove_prefix(1);
+        return rest.empty() ? std::string(".") : std::string(rest);
+    }
+
+    // Canonical archive member of a host path below an archive root.
+    static std::optional<std::string> member(const std::string& host_path)
+    {
+        const auto rest = archive ? relative(host_path) : std::nullopt;
+        return rest ? archive->resolve(*rest) : std::nullopt;
+    }
+
+    static std::string in_root(const std::string& member)
+    {
+        return member.empty() ? root : std::format("{}/{}", root, member);
+    }
+
+    // `spec` names the layers, bottom first, separated by ':'.
+    static bool enter_archive(const std::string& spec)
+    {
+        std::vector<std::string> layers;
+        for (const auto part : spec | v::split(':'))
+        {
+            std::error_code ec;
+            const auto canonical = fs::canonical(std::string(part.begin(), part.end()), ec);
+            if (ec) return false;
+            layers.push_back(canonical.string());
+        }
+        archive = ImageArchive::open(layers);
+        if (!archive) return false;
+        for (const auto& layer : layers) root += (root.empty() ? "" : ":") + layer;
+        return true;
+    }
+
+public:
+    // Switches to the image at `spec`, or back to the host for an empty `spec`. A directory is
+    // an extracted root; anything else is read as tar layers.
+    static bool enter(const std::string& spec)
+    {
+        if (root_fd != -1) close(root_fd);
+        root_fd = -1;
+        archive.reset();
+        root.clear();
+        if (spec.empty()) return true;
+
+        std::error_code ec;
+        if (!fs::is_directory(spec, ec)) return enter_archive(spec);
+        const auto canonical = fs::canonical(spec, ec);
+        if (ec) return false;
+        if (canonical == "/") return true;
+
+        root_fd = ::open(canonical.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (root_fd == -1) return false;
+        root = canonical.string();
+
+        // openat2 needs Linux 5.6; without it nothing could be confined.
+        const int probe = open_file(root, O_PATH);
+        if (probe == -1)
+        {
+            enter("");
+            return false;
+        }
+        close(probe);
+        return true;
+    }
+
+    static bool active() { return root_fd != -1 || archive; }
+    static bool archived() { return archive != nullptr; }
+    static const std::string& path() { return root; }
+
+    // Host path of an absolute path inside the image; relative paths are left alone.
+    static std::string host(std::string_view image_path)
+    {
+        if (!active() || !image_path.starts_with('/')) return std::string(image_path);
+        return root + std::string(image_path);
+    }
+
+    // Canonical host path of a path given inside the image (relative ones start at its root).
+    // Missing files keep their unresolved host path so errors can name it.
+    static std::string locate(const std::string& image_path)
+    {
+        if (!active()) return image_path;
+        const auto in_root = host(image_path.starts_with('/') ? image_path : "/" + image_path);
+        return canonical(in_root).value_or(in_root);
+    }
+
+    // Image path of a host path below the root.
+    static std::string image(std::string_view host_path)
+    {
+        auto rest = active() ? relative(host_path) : std::nullopt;
+        if (!rest) return std::string(host_path);
+        return *rest == "." ? "/" : "/" + *rest;
+    }
+
+    // open(2); below an active root the path is resolved inside it. Archive members have no
+    // descriptor: read them through contents().
+    static int open_file(const std::string& host_path, int flags)
+    {
+        const auto rest = active() ? relative(host_path) : std::nullopt;
+        if (!rest) return ::open(host_path.c_str(), flags | O_CLOEXEC);
+        if (archive)
+        {
+            errno = ENOTSUP;
+            return -1;
+        }
+
+        open_how how{};
+        how.flags = static_cast<uint64_t>(flags | O_CLOEXEC);
+        how.resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS;
+        return static_cast<int>(syscall(SYS_openat2, root_fd, rest->c_str(), &how, sizeof(how)));
+    }
+
+    // Same answer as `exists(p) ? canonical(p) : nullopt`, confined to the root.
+    static std::optional<std::string> canonical(const std::string& host_path)
+    {
+        const auto rest = active() ? relative(host_path) : std::nullopt;
+        if (!rest)
+        {
+            std::error_code ec;
+            auto resolved = fs::canonical(host_path, ec);
+            if (ec) return std::nullopt;
+            return resolved.string();
+        }
+        if (archive)
+        {
+            auto resolved = archive->resolve(*rest);
+            if (!resolved) return std::nullopt;
+            return in_root(*resolved);
+        }
+
+        const int fd = open_file(host_path, O_PATH);
+        if (fd == -1) return std::nullopt;
+        std::error_code ec;
+        auto resolved = fs::read_symlink(std::format("/proc/self/fd/{}", fd), ec);
+        close(fd);
+        if (ec) return std::nullopt;
+        return resolved.string();
+    }
+
+    // stat(2), answered from the index for members of an archive root.
+    static bool stat(const std::string& host_path, struct stat& st)
+    {
+        if (!archive || !relative(host_path)) return ::stat(host_path.c_str(), &st) == 0;
+        const auto m = member(host_path);
+        return m && archive->stat(*m, st);
+    }
+
+    static bool exists(const std::string& host_path)
+    {
+        struct stat st{};
+        return stat(host_path, st);
+    }
+
+    static bool is_directory(const std::string& host_path)
+    {
+        struct stat st{};
+        return stat(host_path, st) && S_ISDIR(st.st_mode);
+    }
+
+    // Bytes of a regular archive member (empty if there is none); nullopt for paths that are
+    // read from disk.
+    static std::optional<std::string_view> contents(const std::string& host_path)
+    {
+        if (!archive || !relative(host_path)) return std::nullopt;
+        const auto m = member(host_path);
+        return m ? archive->contents(*m) : std::string_view();
+    }
+
+    // Entries of a canonical directory of an archive root; nullptr for directories on disk.
+    static const ImageArchive::Listing* listing(const std::string& host_dir)
+    {
+        const auto rest = archive ? relative(host_dir) : std::nullopt;
+        if (!rest) return nullptr;
+        return archive->list(*rest == "." ? std::string() : *rest);
+    }
+
+    // Host paths of the ELF members below a directory of an archive root.
+    static std::vector<std::string> elf_files(const std::string& host_dir)
+    {
+        std::vector<std::string> out;
+        if (const auto m = member(host_dir))
+        {
+            for (const auto& f : archive->elf_files(*m)) out.push_back(in_root(f));
+        }
+        return out;
+    }
+};
+
+// Read-only bytes of a file: an mmap of a regular file on disk, or an archive member's data
+// inside its layer mapping.
+class MappedFile
+{
+    void* mmap_addr = MAP_FAILED;
+    size_t mmap_size = 0;
+    std::string_view data;
+
+public:
+    explicit MappedFile(const std::string& path)
+    {
+        if (auto member = Sysroot::contents(path))
+        {
+            data = *member;
+            return;
+        }
+
+        const int fd = Sysroot::open_file(path, O_RDONLY);
+        if (fd == -1) return;
+
+        struct stat st{};
+        Stats::count(Stats::STAT_CALLS);
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            mmap_size = st.st_size;
+            mmap_addr = mmap(nullptr, mmap_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            Stats::count(Stats::BYTES_MAPPED, mmap_size);
+            if (mmap_addr != MAP_FAILED) data = {static_cast<const char*>(mmap_addr), mmap_size};
+        }
+        close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        if (mmap_addr != MAP_FAILED) munmap(mmap_addr, mmap_size);
+    }
+
+    bool is_mapped() const { return !data.empty(); }
+    std::string_view bytes() const { return data; }
+
+    // For one front-to-back read of a file on disk.
+    void sequential() const
+    {
+        if (mmap_addr != MAP_FAILED) madvise(mmap_addr, mmap_size, MADV_SEQUENTIAL);
+    }
+};
+
+// ELF class, machine and e_flags of an object; selects compatible ld.so.cache entries.
+struct ElfArch
+{
+    unsigned char elf_class = 0;
+    uint16_t machine = 0;
+    uint32_t flags = 0;
+
+    bool operator==(const ElfArch&) const = default;
+};
+
+// Reads /etc/ld.so.cache in place. Entries are sorted (descending, by _dl_cache_libcmp) in the
+// file, so lookups binary-search the mapped array instead of building a hash table up front.
+class LdCache
+{
+    struct HeaderNew
+    {
+        char magic[20];
+        uint32_t nlibs;
+        uint32_t len_strings;
+        uint32_t unused[5];
+    };
+
+    struct EntryNew
+    {
+        int32_t flags;
+        uint32_t key;
+        uint32_t value;
+        uint32_t osversion;
+        uint64_t hwcap;
+    };
+
+    // Entry flags, from glibc's ldconfig.h.
+    static constexpr int32_t FLAG_TYPE_MASK = 0x00ff;
+    static constexpr int32_t FLAG_ELF_LIBC6 = 0x0003;
+    static constexpr int32_t FLAG_REQUIRED_MASK = 0xff00;
+    static constexpr int32_t FLAG_SPARC_LIB64 = 0x0100;
+    static constexpr int32_t FLAG_IA64_LIB64 = 0x0200;
+    static constexpr int32_t FLAG_X8664_LIB64 = 0x0300;
+    static constexpr int32_t FLAG_S390_LIB64 = 0x0400;
+    static constexpr int32_t FLAG_POWERPC_LIB64 = 0x0500;
+    static constexpr int32_t FLAG_X8664_LIBX32 = 0x0800;
+    static constexpr int32_t FLAG_ARM_LIBHF = 0x0900;
+    static constexpr int32_t FLAG_AARCH64_LIB64 = 0x0a00;
+    static constexpr int32_t FLAG_ARM_LIBSF = 0x0b00;
+    static constexpr int32_t FLAG_RISCV_FLOAT_ABI_SOFT = 0x0f00;
+    static constexpr int32_t FLAG_RISCV_FLOAT_ABI_DOUBLE = 0x1000;
+
+    // hwcap values with these upper bits name a glibc-hwcaps subdirectory.
+    static constexpr uint64_t HWCAP_EXTENSION = uint64_t{1} << 62;
+
+    static constexpr uint16_t MACHINE_386 = 3;
+    static constexpr uint16_t MACHINE_SPARCV9 = 43;
+    static constexpr uint16_t MACHINE_PPC64 = 21;
+    static constexpr uint16_t MACHINE_S390 = 22;
+    static constexpr uint16_t MACHINE_ARM = 40;
+    static constexpr uint16_t MACHINE_IA_64 = 50;
+    static constexpr uint16_t MACHINE_X86_64 = 62;
+    static constexpr uint16_t MACHINE_AARCH64 = 183;
+    static constexpr uint16_t MACHINE_RISCV = 243;
+    static constexpr uint32_t EF_ARM_ABI_FLOAT_HARD = 0x400;
+
+    std::span<const EntryNew> entries;
+    std::optional<MappedFile> file;
+    std::string_view data;
+
+    // Same ordering as glibc's _dl_cache_libcmp: digit runs compare numerically.
+    static int libcmp(std::string_view a, std::string_view b)
+    {
+        auto is_digit = [](char c) { return c >= '0' && c <= '9'; };
+        size_t i = 0, j = 0;
+        while (i < a.size())
+        {
+            if (is_digit(a[i]))
+            {
+                if (j >= b.size() || !is_digit(b[j])) return 1;
+                uint64_t va = 0, vb = 0;
+                while (i < a.size() && is_digit(a[i])) va = va * 10 + (a[i++] - '0');
+                while (j < b.size() && is_digit(b[j])) vb = vb * 10 + (b[j++] - '0');
+                if (va != vb) return va < vb ? -1 : 1;
+            }
+            else if (j < b.size() && is_digit(b[j]))
+            {
+                return -1;
+            }
+            else if (j >= b.size() || a[i] != b[j])
+            {
+                return a[i] - (j < b.size() ? b[j] : 0);
+            }
+            else
+            {
+                ++i;
+                ++j;
+            }
+        }
+        return j < b.size() ? -b[j] : 0;
+    }
+
+    std::optional<std::string_view> string_at(uint32_t off) const
+    {
+        if (off >= data.size()) return std::nullopt;
+        const auto rest = data.substr(off);
+        const auto end = rest.find('\0');
+        if (end == std::string_view::npos) return std::nullopt;
+        return rest.substr(0, end);
+    }
+
+    static bool flags_match(int32_t flags, const ElfArch& arch)
+    {
+        if ((flags & FLAG_TYPE_MASK) != FLAG_ELF_LIBC6) return false;
+        const int32_t required = flags & FLAG_REQUIRED_MASK;
+        const bool is64 = arch.elf_class == ELFIO::ELFCLASS64;
+
+        switch (arch.machine)
+        {
+        case 0: return true; // Unknown requester: accept anything, like before.
+        case MACHINE_386: return required == 0;
+        case MACHINE_X86_64: return required == (is64 ? FLAG_X8664_LIB64 : FLAG_X8664_LIBX32);
+        case MACHINE_AARCH64: return required == FLAG_AARCH64_LIB64;
+        case MACHINE_ARM:
+            return required == 0 ||
+                   required == ((arch.flags & EF_ARM_ABI_FLOAT_HARD) ? FLAG_ARM_LIBHF : FLAG_ARM_LIBSF);
+        case MACHINE_PPC64: return required == FLAG_POWERPC_LIB64;
+        case MACHINE_S390: return required == (is64 ? FLAG_S390_LIB64 : 0);
+        case MACHINE_SPARCV9: return required == FLAG_SPARC_LIB64;
+        case MACHINE_IA_64: return required == FLAG_IA64_LIB64;
+        case MACHINE_RISCV:
+            return !is64 || required == FLAG_RISCV_FLOAT_ABI_DOUBLE || required == FLAG_RISCV_FLOAT_ABI_SOFT;
+        default: return true;
+        }
+    }
+
+    // Priority of a glibc-hwcaps subdirectory on this host (higher wins, 0 = unusable).
+    static int hwcaps_priority(std::string_view subdir, const ElfArch& arch)
+    {
+#if defined(__x86_64__)
+        if (arch.machine != MACHINE_X86_64 || arch.elf_class != ELFIO::ELFCLASS64) return 0;
+        static const int level = []
+        {
+            __builtin_cpu_init();
+            int lvl = 1;
+            if (__builtin_cpu_supports("popcnt") && __builtin_cpu_supports("sse4.2") &&
+                __builtin_cpu_supports("ssse3"))
+                lvl = 2;
+            if (lvl == 2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2") &&
+                __builtin_cpu_supports("fma"))
+                lvl = 3;
+            if (lvl == 3 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+                __builtin_cpu_supports("avx512cd") && __builtin_cpu_supports("avx512dq") &&
+                __builtin_cpu_supports("avx512vl"))
+                lvl = 4;
+            return lvl;
+        }();
+        for (int v = 2; v <= 4; ++v)
+        {
+            if (subdir == std::format("x86-64-v{}", v)) return v <= level ? v : 0;
+        }
+#else
+        (void)subdir;
+        (void)arch;
+#endif
+        return 0;
+    }
+
+public:
+    LdCache()
+    {
+        Stats::Scope scope(Stats::LD_CACHE);
+        data = file.emplace(Sysroot::host("/etc/ld.so.cache")).bytes();
+        if (data.size() < sizeof(HeaderNew)) return;
+        const auto* header = reinterpret_cast<const HeaderNew*>(data.data());
+
+        std::string_view magic(header->magic, 17);
+        if (magic == "glibc-ld.so.cache" && header->magic[17] == '1')
+        {
+            size_t offset_strings = sizeof(HeaderNew) + header->nlibs * sizeof(EntryNew);
+            if (offset_strings > data.size()) return;
+
+            entries = std::span(reinterpret_cast<const EntryNew*>(data.data() + sizeof(HeaderNew)), header->nlibs);
+        }
+    }
+
+    LdCache(const LdCache&) = delete;
+    LdCache& operator=(const LdCache&) = delete;
+
+    // Mirrors ld.so's search_cache: find the run of entries for `soname`, skip those built for
+    // another ABI, and prefer the best glibc-hwcaps variant this host can load.
+    std::optional<std::string> resolve(const std::string& soname, const ElfArch& arch = {}) const
+    {
+        auto cmp = [&](size_t i)
+        {
+            auto key = string_at(entries[i].key);
+            return key ? libcmp(soname, *key) : 1;
+        };
+
+        ptrdiff_t left = 0;
+        ptrdiff_t right = static_cast<ptrdiff_t>(entries.size()) - 1;
+        std::optional<size_t> hit;
+        while (left <= right)
+        {
+            const ptrdiff_t middle = left + (right - left) / 2;
+            const int c = cmp(middle);
+            if (c == 0)
+            {
+                hit = middle;
+                break;
+            }
+            if (c < 0) left = middle + 1;
+            else right = middle - 1;
+        }
+        if (!hit) return std::nullopt;
+
+        size_t first = *hit;
+        while (first > 0 && cmp(first - 1) == 0) --first;
+
+        std::optional<std::string_view> best;
+        int best_priority = -1;
+        for (size_t i = first; i < entries.size() && cmp(i) == 0; ++i)
+        {
+            const auto& e = entries[i];
+            if (!flags_match(e.flags, arch)) continue;
+
+            auto value = string_at(e.value);
+            if (!value) continue;
+
+            int priority = 0;
+            if ((e.hwcap >> 32) == (HWCAP_EXTENSION >> 32))
+            {
+                constexpr std::string_view marker = "/glibc-hwcaps/";
+                const auto pos = value->find(marker);
+                if (pos == std::string_view::npos) continue;
+                auto subdir = value->substr(pos + marker.size());
+                subdir = subdir.substr(0, subdir.find('/'));
+                priority = hwcaps_priority(subdir, arch);
+                if (priority == 0) continue;
+            }
+            else if (e.hwcap != 0)
+            {
+                // Legacy hwcap subdirectories are no longer honoured by ld.so.
+                continue;
+            }
+
+            if (priority > best_priority)
+            {
+                best = value;
+                best_priority = priority;
+            }
+        }
+
+        if (!best) return std::nullopt;
+        return std::string(*best);
+    }
+};
+
+// Sorted path -> package table persisted next to the dynamic cache. It is stamped with the mtime
+// of the pacman local DB directory, which changes whenever a package is installed or removed.
+// Layout, native byte order: Header | Entry[count] sorted by path | char strings[]
+class PackageIndex
+{
+    struct Header
+    {
+        char magic[8];
+        uint32_t byte_order;
+        uint32_t count;
+        int64_t db_mtime_sec;
+        int64_t db_mtime_nsec;
+        uint64_t strings_offset;
+        uint64_t strings_size;
+    };
+
+    struct Entry
+    {
+        uint32_t path_off;
+        uint32_t path_len;
+        uint32_t pkg_off;
+        uint32_t pkg_len;
+    };
+
+    static constexpr std::string_view MAGIC{"IDPKGI1\0", 8};
+    static constexpr uint32_t ENDIAN_TAG = 0x01020304;
+
+    void* mmap_addr = MAP_FAILED;
+    size_t mmap_size = 0;
+    std::string owned;
+    std::span<const Entry> entries;
+    std::string_view strings;
+
+    std::string_view str(uint32_t off, uint32_t len) const
+    {
+        if (off > strings.size() || len > strings.size() - off) return {};
+        return strings.substr(off, len);
+    }
+
+    bool attach(const char* base, size_t size, const timespec& db_mtime)
+    {
+        if (size < sizeof(Header)) return false;
+        const auto* header = reinterpret_cast<const Header*>(base);
+        if (std::string_view(header->magic, 8) != MAGIC || header->byte_order != ENDIAN_TAG) return false;
+        if (header->db_mtime_sec != db_mtime.tv_sec || header->db_mtime_nsec != db_mtime.tv_nsec) return false;
+
+        const uint64_t entries_end = sizeof(Header) + static_cast<uint64_t>(header->count) * sizeof(Entry);
+        if (entries_end > size || header->strings_offset < entries_end || header->strings_offset > size ||
+            header->strings_size > size - header->strings_offset)
+            return false;
+
+        entries = std::span(reinterpret_cast<const Entry*>(base + sizeof(Header)), header->count);
+        strings = std::string_view(base + header->strings_offset, header->strings_size);
+        return true;
+    }
+
+    PackageIndex() = default;
+
+public:
+    PackageIndex(const PackageIndex&) = delete;
+    PackageIndex& operator=(const PackageIndex&) = delete;
+
+    ~PackageIndex()
+    {
+        if (mmap_addr != MAP_FAILED) munmap(mmap_addr, mmap_size);
+    }
+
+    // Maps an existing index; fails if it is missing, corrupt or older than the local DB.
+    static std::unique_ptr<PackageIndex> open(const std::string& path, const timespec& db_mtime)
+    {
+        Stats::Scope scope(Stats::PKG_INDEX);
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) return nullptr;
+
+        std::unique_ptr<PackageIndex> index(new PackageIndex());
+        struct stat st{};
+        Stats::count(Stats::STAT_CALLS);
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            index->mmap_size = st.st_size;
+            index->mmap_addr = mmap(nullptr, index->mmap_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            Stats::count(Stats::BYTES_MAPPED, index->mmap_size);
+        }
+        close(fd);
+
+        if (index->mmap_addr == MAP_FAILED) return nullptr;
+        if (!index->attach(static_cast<const char*>(index->mmap_addr), index->mmap_size, db_mtime)) return nullptr;
+        return index;
+    }
+
+    // Builds an index from (path without leading '/', package) pairs and, given a path, tries to
+    // persist it. The returned index works from memory even if the file could not be written.
+    static std::unique_ptr<PackageIndex> create(const std::string& path, const timespec& db_mtime,
+                                                std::vector<std::pair<std::string, std::string>> files)
+    {
+        r::sort(files, {}, &std::pair<std::string, std::string>::first);
+        auto dup = r::unique(files, {}, &std::pair<std::string, std::string>::first);
+        files.erase(dup.begin(), dup.end());
+
+        std::string string_table;
+        std::unordered_map<std::string, uint32_t> pkg_offsets;
+        std::vector<Entry> out;
+        out.reserve(files.size());
+        for (const auto& [file, pkg] : files)
+        {
+            auto [it, inserted] = pkg_offsets.try_emplace(pkg, static_cast<uint32_t>(string_table.size()));
+            if (inserted) string_table += pkg;
+            out.push_back({0, static_cast<uint32_t>(file.size()), it->second, static_cast<uint32_t>(pkg.size())});
+        }
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            out[i].path_off = static_cast<uint32_t>(string_table.size());
+            string_table += files[i].first;
+        }
+
+        Header header{};
+        std::memcpy(header.magic, MAGIC.data(), MAGIC.size());
+        header.byte_order = ENDIAN_TAG;
+        header.count = static_cast<uint32_t>(out.size());
+        header.db_mtime_sec = db_mtime.tv_sec;
+        header.db_mtime_nsec = db_mtime.tv_nsec;
+        header.strings_offset = sizeof(Header) + out.size() * sizeof(Entry);
+        header.strings_size = string_table.size();
+
+        std::unique_ptr<PackageIndex> index(new PackageIndex());
+        auto& blob = index->owned;
+        blob.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        blob.append(reinterpret_cast<const char*>(out.data()), out.size() * sizeof(Entry));
+        blob.append(string_table);
+
+        if (!path.empty())
+        {
+            std::error_code ec;
+            fs::create_directories(fs::path(path).parent_path(), ec);
+            const std::string tmp = std::format("{}.{}.tmp", path, getpid());
+            {
+                std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+                f.write(blob.data(), static_cast<std::streamsize>(blob.size()));
+                if (!f) fs::remove(tmp, ec);
+            }
+            if (fs::exists(tmp, ec))
+            {
+                fs::rename(tmp, path, ec);
+                if (ec) fs::remove(tmp, ec);
+            }
+        }
+
+        index->attach(blob.data(), blob.size(), db_mtime);
+        return index;
+    }
+
+    std::optional<std::string> find(std::string_view path) const
+    {
+        if (path.starts_with('/')) path.remove_prefix(1);
+        const auto it = r::lower_bound(entries, path, {}, [&](const Entry& e) { return str(e.path_off, e.path_len); });
+        if (it == entries.end() || str(it->path_off, it->path_len) != path) return std::nullopt;
+        return std::string(str(it->pkg_off, it->pkg_len));
+    }
+};
+
+class AlpmManager
+{
+    void* lib_handle = nullptr;
+    alpm_handle_t* handle = nullptr;
+    alpm_db_t* db_local = nullptr;
+    std::unordered_map<std::string, std::string> pkg_cache;
+    bool initialized = false;
+    bool loaded = false;
+    std::optional<std::string> index_path;
+    std::unique_ptr<PackageIndex> index;
+
+    // Function pointers
+    alpm_initialize_fn _alpm_initialize = nullptr;
+    alpm_release_fn _alpm_release = nullptr;
+    alpm_get_localdb_fn _alpm_get_localdb = nullptr;
+    alpm_strerror_fn _alpm_strerror = nullptr;
+    alpm_db_get_pkgcache_fn _alpm_db_get_pkgcache = nullptr;
+    alpm_list_next_fn _alpm_list_next = nullptr;
+    alpm_pkg_get_files_fn _alpm_pkg_get_files = nullptr;
+    alpm_pkg_get_name_fn _alpm_pkg_get_name = nullptr;
+
+    template <typename T>
+    static T sym(void* handle, const char* name)
+    {
+        return reinterpret_cast<T>(dlsym(handle, name));
+    }
+
+    void load_alpm()
+    {
+        Stats::Scope scope(Stats::ALPM_INIT);
+        lib_handle = dlopen("libalpm.so", RTLD_LAZY);
+        if (!lib_handle)
+        {
+            lib_handle = dlopen("libalpm.so.13", RTLD_LAZY);
+        }
+        if (!lib_handle)
+        {
+            lib_handle = dlopen("libalpm.so.14", RTLD_LAZY);
+        }
+
+        if (!lib_handle) return;
+
+        _alpm_initialize = sym<alpm_initialize_fn>(lib_handle, "alpm_initialize");
+        _alpm_release = sym<alpm_release_fn>(lib_handle, "alpm_release");
+        _alpm_get_localdb = sym<alpm_get_localdb_fn>(lib_handle, "alpm_get_localdb");
+        _alpm_strerror = sym<alpm_strerror_fn>(lib_handle, "alpm_strerror");
+        _alpm_db_get_pkgcache = sym<alpm_db_get_pkgcache_fn>(lib_handle, "alpm_db_get_pkgcache");
+        _alpm_list_next = sym<alpm_list_next_fn>(lib_handle, "alpm_list_next");
+        _alpm_pkg_get_files = sym<alpm_pkg_get_files_fn>(lib_handle, "alpm_pkg_get_files");
+        _alpm_pkg_get_name = sym<alpm_pkg_get_name_fn>(lib_handle, "alpm_pkg_get_name");
+
+        if (!_alpm_initialize || !_alpm_release || !_alpm_get_localdb || !_alpm_strerror ||
+            !_alpm_db_get_pkgcache || !_alpm_list_next || !_alpm_pkg_get_files || !_alpm_pkg_get_name)
+        {
+            std::println(std::cerr, "Failed to load ALPM symbols.");
+            dlclose(lib_handle);
+            lib_handle = nullptr;
+            return;
+        }
+
+        alpm_errno_t err;
+        const auto root = Sysroot::host("/");
+        handle = _alpm_initialize(root.c_str(), Sysroot::host(DB_PATH).c_str(), &err);
+        if (handle)
+        {
+            db_local = _alpm_get_localdb(handle);
+            initialized = true;
+        }
+        else
+        {
+            std::println(std::cerr, "Failed to initialize alpm: {}", _alpm_strerror(err));
+        }
+    }
+
+    std::unique_ptr<PackageIndex> build_index(const timespec& db_mtime)
+    {
+        Stats::Scope scope(Stats::PKG_INDEX);
+        std::vector<std::pair<std::string, std::string>> files;
+        const alpm_list_t* pkg_cache_list = _alpm_db_get_pkgcache(db_local);
+        for (const alpm_list_t* i = pkg_cache_list; i; i = _alpm_list_next(i))
+        {
+            Stats::count(Stats::PACKAGES_SCANNED);
+            auto* pkg = static_cast<alpm_pkg_t*>(i->data);
+            const alpm_filelist_t* pkg_files = _alpm_pkg_get_files(pkg);
+            const char* name = _alpm_pkg_get_name(pkg);
+
+            for (size_t f = 0; f < pkg_files->count; ++f)
+            {
+                std::string_view filename = pkg_files->files[f].name;
+                if (!filename.ends_with('/')) files.emplace_back(filename, name);
+            }
+        }
+        return PackageIndex::create(*index_path, db_mtime, std::move(files));
+    }
+
+    // Lines of one "%SECTION%" block of a pacman DB entry.
+    static std::vector<std::string_view> db_section(std::string_view text, std::string_view header)
+    {
+        std::vector<std::string_view> lines;
+        bool inside = false;
+        for (const auto part : text | v::split('\n'))
+        {
+            const std::string_view line(part.begin(), part.end());
+            if (!inside)
+            {
+                inside = line == header;
+                continue;
+            }
+            if (line.empty()) break;
+            lines.push_back(line);
+        }
+        return lines;
+    }
+
+    // libalpm only opens a DB on disk, so the local DB of an archive root is read directly from
+    // each package's "desc" and "files" entries into an in-memory index.
+    static std::unique_ptr<PackageIndex> index_image_db()
+    {
+        Stats::Scope scope(Stats::PKG_INDEX);
+        const auto local = Sysroot::canonical(Sysroot::host(std::format("{}/local", DB_PATH)));
+        const auto* entries = local ? Sysroot::listing(*local) : nullptr;
+        if (!entries) return nullptr;
+
+        std::vector<std::pair<std::string, std::string>> files;
+        for (const auto& [entry, type] : *entries)
+        {
+            if (type != DT_DIR) continue;
+            Stats::count(Stats::PACKAGES_SCANNED);
+            const MappedFile desc(std::format("{}/{}/desc", *local, entry));
+            const MappedFile list(std::format("{}/{}/files", *local, entry));
+            const auto name = db_section(desc.bytes(), "%NAME%");
+            if (name.empty()) continue;
+            for (const auto path : db_section(list.bytes(), "%FILES%"))
+            {
+                if (!path.ends_with('/')) files.emplace_back(path, name.front());
+            }
+        }
+        return PackageIndex::create({}, {}, std::move(files));
+    }
+
+    // libalpm is only loaded when there is no up-to-date index to answer from.
+    void ensure_loaded()
+    {
+        if (loaded) return;
+        loaded = true;
+
+        if (Sysroot::archived())
+        {
+            index = index_image_db();
+            initialized = index != nullptr;
+            return;
+        }
+
+        if (index_path)
+        {
+            struct stat st{};
+            Stats::count(Stats::STAT_CALLS);
+            if (stat(std::format("{}/local", DB_PATH).c_str(), &st) == 0)
+            {
+                index = PackageIndex::open(*index_path, st.st_mtim);
+                if (index)
+                {
+                    initialized = true;
+                    return;
+                }
+
+                load_alpm();
+                if (initialized && db_local) index = build_index(st.st_mtim);
+                return;
+            }
+        }
+
+        load_alpm();
+    }
+
+public:
+    static constexpr const char* DB_PATH = "/var/lib/pacman";
+
+    AlpmManager() = default;
+
+    AlpmManager(const AlpmManager&) = delete;
+    AlpmManager& operator=(const AlpmManager&) = delete;
+
+    ~AlpmManager()
+    {
+        if (handle && _alpm_release) _alpm_release(handle);
+        if (lib_handle) dlclose(lib_handle);
+    }
+
+    // Answer lookups from a persistent index at `path` instead of scanning every package filelist.
+    void use_index(std::string path) { index_path = std::move(path); }
+
+    void batch_resolve(const std::vector<std::string>& paths)
+    {
+        Stats::Scope scope(Stats::PACKAGES);
+        ensure_loaded();
+        if (index)
+        {
+            for (const auto& p : paths)
+            {
+                if (pkg_cache.contains(p)) continue;
+                if (auto pkg = index->find(Sysroot::image(p))) pkg_cache[p] = std::move(*pkg);
+            }
+            return;
+        }
+        if (!initialized || !db_local) return;
+
+        std::vector<std::string> to_find;
+        for (const auto& p : paths)
+        {
+            if (!pkg_cache.contains(p)) to_find.push_back(p);
+        }
+        if (to_find.empty()) return;
+
+        std::unordered_map<std::string, std::string> lookup_map;
+        for (const auto& p : to_find)
+        {
+            if (p.starts_with('/'))
+            {
+                lookup_map[Sysroot::image(p).substr(1)] = p;
+            }
+            else
+            {
+                lookup_map[p] = p;
+            }
+        }
+
+        const alpm_list_t* pkg_cache_list = _alpm_db_get_pkgcache(db_local);
+        for (const alpm_list_t* i = pkg_cache_list; i; i = _alpm_list_next(i))
+        {
+            Stats::count(Stats::PACKAGES_SCANNED);
+            auto* pkg = static_cast<alpm_pkg_t*>(i->data);
+            const alpm_filelist_t* files = _alpm_pkg_get_files(pkg);
+
+            for (size_t f = 0; f < files->count; ++f)
+            {
+                const char* filename = files->files[f].name;
+                if (auto it = lookup_map.find(filename); it != lookup_map.end())
+                {
+                    pkg_cache[it->second] = _alpm_pkg_get_name(pkg);
+                    lookup_map.erase(it);
+                    if (lookup_map.empty()) return;
+                }
+            }
+        }
+    }
+
+    std::string get_package(const std::string& path)
+    {
+        if (const auto it = pkg_cache.find(path); it != pkg_cache.end())
+        {
+            return it->second;
+        }
+        return "-";
+    }
+
+    bool is_available()
+    {
+        ensure_loaded();
+        return initialized;
+    }
+};
+
+// What ld.so has to do for one object at startup, read from PT_LOAD and the dynamic section.
+struct LinkCost
+{
+    static constexpr uint32_t BIND_NOW = 1;
+    static constexpr uint32_t GNU_HASH = 2;
+    static constexpr uint32_t SYSV_HASH = 4;
+
+    uint64_t load_size = 0;
+    uint32_t relative_relocs = 0;
+    uint32_t symbolic_relocs = 0;
+    uint32_t plt_relocs = 0;
+    uint32_t exported = 0;
+    uint32_t imported = 0;
+    uint32_t flags = 0;
+};
+
+// Memory one object maps, from PT_LOAD and PT_GNU_RELRO, in bytes of whole pages. Writable
+// pages are private to each process: data is copy-on-write file pages, bss anonymous ones.
+// relro is the part of data made read-only again after relocation.
+struct Footprint
+{
+    uint64_t text = 0;
+    uint64_t rodata = 0;
+    uint64_t data = 0;
+    uint64_t bss = 0;
+    uint64_t relro = 0;
+
+    uint64_t writable() const { return data + bss; }
+
+    Footprint& operator+=(const Footprint& o)
+    {
+        text += o.text;
+        rodata += o.rodata;
+        data += o.data;
+        bss += o.bss;
+        relro += o.relro;
+        return *this;
+    }
+};
+
+// Zero-copy view of the dynamic section. Strings point into the mapping owned by MappedElf.
+struct DynamicView
+{
+    ElfArch arch;
+    LinkCost cost;
+    Footprint footprint;
+    std::vector<std::string_view> needed;
+    std::string_view soname;
+    std::string_view rpath;
+    std::string_view runpath;
+};
+
+// Hash of glibc's DT_GNU_HASH (dl_new_hash), reused for our own export tables.
+struct GnuHash
+{
+    using is_transparent = void;
+
+    static uint32_t of(std::string_view s)
+    {
+        uint32_t h = 5381;
+        for (const unsigned char c : s) h = h * 33 + c;
+        return h;
+    }
+
+    size_t operator()(std::string_view s) const { return of(s); }
+};
+
+// Dynamic symbols of one object. Versioned names are "name@version"; a versioned export is
+// stored under both spellings, so an unversioned reference finds it too. Like DT_GNU_HASH,
+// exports sit behind a two-bit bloom filter so most misses cost one word read. definitions
+// holds each defined symbol once, in its most specific spelling; the views point into exports,
+// so a table is moved, never copied.
+struct SymbolTable
+{
+    std::vector<std::string> imports;
+    std::vector<std::string> copies;
+    std::unordered_set<std::string, GnuHash, std::equal_to<>> exports;
+    std::vector<std::string_view> definitions;
+    std::vector<uint64_t> bloom;
+
+    static constexpr uint32_t BLOOM_SHIFT = 6;
+
+    void build_bloom()
+    {
+        bloom.assign(std::bit_ceil(std::max<size_t>(exports.size() / 16, 1)), 0);
+        for (const auto& name : exports)
+        {
+            const uint32_t h = GnuHash::of(name);
+            bloom[(h / 64) & (bloom.size() - 1)] |= (uint64_t{1} << (h % 64)) | (uint64_t{1} << ((h >> BLOOM_SHIFT) % 64));
+        }
+    }
+
+    bool defines(std::string_view name, uint32_t hash) const
+    {
+        if (bloom.empty()) return false;
+        const uint64_t mask = (uint64_t{1} << (hash % 64)) | (uint64_t{1} << ((hash >> BLOOM_SHIFT) % 64));
+        if ((bloom[(hash / 64) & (bloom.size() - 1)] & mask) != mask) return false;
+        return exports.contains(name);
+    }
+};
+
+class MappedElf
+{
+    struct Elf32
+    {
+        struct Ehdr
+        {
+            unsigned char e_ident[16];
+            uint16_t e_type;
+            uint16_t e_machine;
+            uint32_t e_version;
+            uint32_t e_entry;
+            uint32_t e_phoff;
+            uint32_t e_shoff;
+            uint32_t e_flags;
+            uint16_t e_ehsize;
+            uint16_t e_phentsize;
+            uint16_t e_phnum;
+            uint16_t e_shentsize;
+            uint16_t e_shnum;
+            uint16_t e_shstrndx;
+        };
+
+        struct Phdr
+        {
+            uint32_t p_type;
+            uint32_t p_offset;
+            uint32_t p_vaddr;
+            uint32_t p_paddr;
+            uint32_t p_filesz;
+            uint32_t p_memsz;
+            uint32_t p_flags;
+            uint32_t p_align;
+        };
+
+        struct Dyn
+        {
+            int32_t d_tag;
+            uint32_t d_val;
+        };
+
+        struct Shdr
+        {
+            uint32_t sh_name;
+            uint32_t sh_type;
+            uint32_t sh_flags;
+            uint32_t sh_addr;
+            uint32_t sh_offset;
+            uint32_t sh_size;
+            uint32_t sh_link;
+            uint32_t sh_info;
+            uint32_t sh_addralign;
+            uint32_t sh_entsize;
+        };
+
+        struct Sym
+        {
+            uint32_t st_name;
+            uint32_t st_value;
+            uint32_t st_size;
+            unsigned char st_info;
+            unsigned char st_other;
+            uint16_t st_shndx;
+        };
+
+        static constexpr uint64_t WORD = 4;
+    };
+
+    struct Elf64
+    {
+        struct Ehdr
+        {
+            unsigned char e_ident[16];
+            uint16_t e_type;
+            uint16_t e_machine;
+            uint32_t e_version;
+            uint64_t e_entry;
+            uint64_t e_phoff;
+            uint64_t e_shoff;
+            uint32_t e_flags;
+            uint16_t e_ehsize;
+            uint16_t e_phentsize;
+            uint16_t e_phnum;
+            uint16_t e_shentsize;
+            uint16_t e_shnum;
+            uint16_t e_shstrndx;
+        };
+
+        struct Phdr
+        {
+            uint32_t p_type;
+            uint32_t p_flags;
+            uint64_t p_offset;
+            uint64_t p_vaddr;
+            uint64_t p_paddr;
+            uint64_t p_filesz;
+            uint64_t p_memsz;
+            uint64_t p_align;
+        };
+
+        struct Dyn
+        {
+            int64_t d_tag;
+            uint64_t d_val;
+        };
+
+        struct Shdr
+        {
+            uint32_t sh_name;
+            uint32_t sh_type;
+            uint64_t sh_flags;
+            uint64_t sh_addr;
+            uint64_t sh_offset;
+            uint64_t sh_size;
+            uint32_t sh_link;
+            uint32_t sh_info;
+            uint64_t sh_addralign;
+            uint64_t sh_entsize;
+        };
+
+        struct Sym
+        {
+            uint32_t st_name;
+            unsigned char st_info;
+            unsigned char st_other;
+            uint16_t st_shndx;
+            uint64_t st_value;
+            uint64_t st_size;
+        };
+
+        static constexpr uint64_t WORD = 8;
+    };
+
+    // Tags and flags used for startup cost and symbol versions; spelled out as plain ELF values.
+    static constexpr int64_t DT_PLTRELSZ = 2;
+    static constexpr int64_t DT_HASH = 4;
+    static constexpr int64_t DT_SYMTAB = 6;
+    static constexpr int64_t DT_RELA = 7;
+    static constexpr int64_t DT_RELASZ = 8;
+    static constexpr int64_t DT_RELAENT = 9;
+    static constexpr int64_t DT_SYMENT = 11;
+    static constexpr int64_t DT_REL = 17;
+    static constexpr int64_t DT_RELSZ = 18;
+    static constexpr int64_t DT_RELENT = 19;
+    static constexpr int64_t DT_PLTREL = 20;
+    static constexpr int64_t DT_BIND_NOW = 24;
+    static constexpr int64_t DT_FLAGS = 30;
+    static constexpr int64_t DT_RELRSZ = 35;
+    static constexpr int64_t DT_RELR = 36;
+    static constexpr int64_t DT_GNU_HASH = 0x6ffffef5;
+    static constexpr int64_t DT_VERSYM = 0x6ffffff0;
+    static constexpr int64_t DT_VERDEF = 0x6ffffffc;
+    static constexpr int64_t DT_VERDEFNUM = 0x6ffffffd;
+    static constexpr int64_t DT_VERNEED = 0x6ffffffe;
+    static constexpr int64_t DT_VERNEEDNUM = 0x6fffffff;
+    static constexpr int64_t DT_RELACOUNT = 0x6ffffff9;
+    static constexpr int64_t DT_RELCOUNT = 0x6ffffffa;
+    static constexpr int64_t DT_FLAGS_1 = 0x6ffffffb;
+    static constexpr uint64_t DF_BIND_NOW = 0x8;
+    static constexpr uint64_t DF_1_NOW = 0x1;
+    static constexpr uint32_t SHT_DYNSYM = 11;
+    static constexpr uint16_t SHN_ABS = 0xfff1;
+    static constexpr uint64_t PAGE = 4096;
+
+    MappedFile file;
+    std::string_view image;
+    bool swap = false;
+
+    template <typename T>
+    T fix(T value) const
+    {
+        if constexpr (sizeof(T) == 1) return value;
+        else return swap ? std::byteswap(value) : value;
+    }
+
+    template <typename T>
+    std::optional<T> read(uint64_t offset) const
+    {
+        if (offset > image.size() || image.size() - offset < sizeof(T)) return std::nullopt;
+        T out;
+        std::memcpy(&out, image.data() + offset, sizeof(T));
+        return out;
+    }
+
+    std::optional<std::string_view> string_at(uint64_t strtab, uint64_t strsz, uint64_t idx) const
+    {
+        if (idx >= strsz || strtab > image.size() || strsz > image.size() - strtab) return std::nullopt;
+        const char* begin = image.data() + strtab + idx;
+        const auto* end = static_cast<const char*>(std::memchr(begin, '\0', strsz - idx));
+        if (!end) return std::nullopt;
+        return std::string_view(begin, end);
+    }
+
+    // Program headers and dynamic tags of the image. DT_NEEDED repeats; for other tags the last
+    // one wins.
+    template <typename E>
+    struct Layout
+    {
+        typename E::Ehdr ehdr;
+        std::vector<typename E::Phdr> loads;
+        std::optional<typename E::Phdr> relro;
+        bool has_dynamic = false;
+        std::vector<uint64_t> needed;
+        std::unordered_map<int64_t, uint64_t> tags;
+
+        std::optional<uint64_t> tag(int64_t t) const
+        {
+            const auto it = tags.find(t);
+            if (it == tags.end()) return std::nullopt;
+            return it->second;
+        }
+    };
+
+    template <typename E>
+    std::optional<Layout<E>> layout() const
+    {
+        auto ehdr = read<typename E::Ehdr>(0);
+        if (!ehdr) return std::nullopt;
+
+        Layout<E> l{*ehdr, {}, std::nullopt, false, {}, {}};
+        const uint64_t phoff = fix(ehdr->e_phoff);
+        const uint16_t phnum = fix(ehdr->e_phnum);
+        const uint16_t phentsize = fix(ehdr->e_phentsize);
+        if (phnum == 0 || phentsize < sizeof(typename E::Phdr)) return std::nullopt;
+
+        std::optional<typename E::Phdr> dynamic;
+        for (uint16_t i = 0; i < phnum; ++i)
+        {
+            auto ph = read<typename E::Phdr>(phoff + static_cast<uint64_t>(i) * phentsize);
+            if (!ph) return std::nullopt;
+            const uint32_t type = fix(ph->p_type);
+            if (type == ELFIO::PT_LOAD) l.loads.push_back(*ph);
+            else if (type == ELFIO::PT_DYNAMIC) dynamic = ph;
+            else if (type == ELFIO::PT_GNU_RELRO) l.relro = ph;
+        }
+
+        // Statically linked: nothing to follow.
+        if (!dynamic) return l;
+        l.has_dynamic = true;
+
+        const uint64_t dyn_off = fix(dynamic->p_offset);
+        const uint64_t dyn_count = fix(dynamic->p_filesz) / sizeof(typename E::Dyn);
+        for (uint64_t i = 0; i < dyn_count; ++i)
+        {
+            auto dyn = read<typename E::Dyn>(dyn_off + i * sizeof(typename E::Dyn));
+            if (!dyn) return std::nullopt;
+            const auto tag = static_cast<int64_t>(fix(dyn->d_tag));
+            const uint64_t val = fix(dyn->d_val);
+            if (tag == ELFIO::DT_NULL) break;
+            if (tag == ELFIO::DT_NEEDED) l.needed.push_back(val);
+            else l.tags[tag] = val;
+        }
+        return l;
+    }
+
+    template <typename E>
+    std::optional<uint64_t> to_offset(const Layout<E>& l, uint64_t vaddr) const
+    {
+        for (const auto& ph : l.loads)
+        {
+            const uint64_t start = fix(ph.p_vaddr);
+            if (vaddr >= start && vaddr - start < fix(ph.p_filesz)) return vaddr - start + fix(ph.p_offset);
+        }
+        return std::nullopt;
+    }
+
+    template <typename E>
+    std::optional<uint64_t> offset_of(const Layout<E>& l, int64_t tag) const
+    {
+        auto addr = l.tag(tag);
+        return addr ? to_offset(l, *addr) : std::nullopt;
+    }
+
+    // File offset and size of DT_STRTAB; a missing or oversized DT_STRSZ runs to the end of the file.
+    template <typename E>
+    std::optional<std::pair<uint64_t, uint64_t>> string_table(const Layout<E>& l) const
+    {
+        auto strtab = offset_of(l, ELFIO::DT_STRTAB);
+        if (!strtab || *strtab >= image.size()) return std::nullopt;
+        uint64_t strsz = l.tag(ELFIO::DT_STRSZ).value_or(0);
+        if (strsz == 0 || strsz > image.size() - *strtab) strsz = image.size() - *strtab;
+        return std::pair(*strtab, strsz);
+    }
+
+    // Number of .dynsym entries: DT_HASH stores it, DT_GNU_HASH has to be walked to the end of
+    // the longest chain.
+    template <typename E>
+    uint64_t symbol_count(std::optional<uint64_t> hash, std::optional<uint64_t> gnu_hash) const
+    {
+        if (hash)
+        {
+            if (auto nchain = read<uint32_t>(*hash + 4)) return fix(*nchain);
+        }
+        if (!gnu_hash) return 0;
+
+        auto nbuckets = read<uint32_t>(*gnu_hash);
+        auto symoffset = read<uint32_t>(*gnu_hash + 4);
+        auto bloom_size = read<uint32_t>(*gnu_hash + 8);
+        if (!nbuckets || !symoffset || !bloom_size) return 0;
+
+        const uint64_t buckets = *gnu_hash + 16 + static_cast<uint64_t>(fix(*bloom_size)) * E::WORD;
+        uint32_t last = 0;
+        for (uint32_t i = 0; i < fix(*nbuckets); ++i)
+        {
+            auto b = read<uint32_t>(buckets + static_cast<uint64_t>(i) * 4);
+            if (!b) return 0;
+            last = std::max(last, fix(*b));
+        }
+        if (last < fix(*symoffset)) return fix(*symoffset);
+
+        const uint64_t chains = buckets + static_cast<uint64_t>(fix(*nbuckets)) * 4;
+        for (;; ++last)
+        {
+            auto c = read<uint32_t>(chains + static_cast<uint64_t>(last - fix(*symoffset)) * 4);
+            if (!c) return 0;
+            if (fix(*c) & 1) return static_cast<uint64_t>(last) + 1;
+        }
+    }
+
+    // DT_GNU_HASH only covers defined symbols, and a library that defines none has no chain to
+    // walk at all, so the .dynsym section header is preferred when it is there.
+    template <typename E>
+    uint64_t symbol_count(const Layout<E>& l) const
+    {
+        const auto hash = offset_of(l, DT_HASH);
+        if (!hash)
+        {
+            const uint64_t shoff = fix(l.ehdr.e_shoff);
+            const uint16_t shentsize = fix(l.ehdr.e_shentsize);
+            for (uint16_t i = 0; shoff && shentsize >= sizeof(typename E::Shdr) && i < fix(l.ehdr.e_shnum); ++i)
+            {
+                auto sh = read<typename E::Shdr>(shoff + static_cast<uint64_t>(i) * shentsize);
+                if (!sh) break;
+                if (fix(sh->sh_type) == SHT_DYNSYM && fix(sh->sh_entsize) > 0)
+                    return fix(sh->sh_size) / fix(sh->sh_entsize);
+            }
+        }
+        return symbol_count<E>(hash, offset_of(l, DT_GNU_HASH));
+    }
+
+    template <typename E>
+    void read_link_cost(const Layout<E>& l, LinkCost& cost) const
+    {
+        const uint64_t relaent = l.tag(DT_RELAENT).value_or(3 * E::WORD);
+        const uint64_t relent = l.tag(DT_RELENT).value_or(2 * E::WORD);
+        const uint64_t relocs = (relaent ? l.tag(DT_RELASZ).value_or(0) / relaent : 0) +
+            (relent ? l.tag(DT_RELSZ).value_or(0) / relent : 0);
+        const uint64_t relative =
+            std::min(relocs, l.tag(DT_RELACOUNT).value_or(0) + l.tag(DT_RELCOUNT).value_or(0));
+        cost.relative_relocs = static_cast<uint32_t>(relative);
+        cost.symbolic_relocs = static_cast<uint32_t>(relocs - relative);
+
+        // DT_PLTRELSZ is in bytes of whichever of REL/RELA DT_PLTREL names.
+        const uint64_t pltent = l.tag(DT_PLTREL) == static_cast<uint64_t>(DT_REL) ? relent : relaent;
+        cost.plt_relocs = static_cast<uint32_t>(l.tag(DT_PLTRELSZ).value_or(0) / std::max<uint64_t>(pltent, 1));
+
+        // RELR: an even word is one address, an odd word a bitmap of the following 63 (or 31) words.
+        if (auto relr = offset_of(l, DT_RELR))
+        {
+            const uint64_t words = l.tag(DT_RELRSZ).value_or(0) / E::WORD;
+            for (uint64_t i = 0; i < words; ++i)
+            {
+                using Word = std::conditional_t<E::WORD == 8, uint64_t, uint32_t>;
+                auto w = read<Word>(*relr + i * E::WORD);
+                if (!w) break;
+                const Word word = fix(*w);
+                cost.relative_relocs += (word & 1) ? std::popcount(word) - 1 : 1;
+            }
+        }
+
+        if (l.tag(DT_BIND_NOW) || (l.tag(DT_FLAGS).value_or(0) & DF_BIND_NOW) ||
+            (l.tag(DT_FLAGS_1).value_or(0) & DF_1_NOW))
+            cost.flags |= LinkCost::BIND_NOW;
+        if (offset_of(l, DT_GNU_HASH)) cost.flags |= LinkCost::GNU_HASH;
+        if (offset_of(l, DT_HASH)) cost.flags |= LinkCost::SYSV_HASH;
+
+        if (auto symtab = offset_of(l, DT_SYMTAB))
+        {
+            const uint64_t syment = l.tag(DT_SYMENT).value_or(sizeof(typename E::Sym));
+            const uint64_t count = symbol_count(l);
+            for (uint64_t i = 1; syment >= sizeof(typename E::Sym) && i < count; ++i)
+            {
+                auto sym = read<typename E::Sym>(*symtab + i * syment);
+                if (!sym) break;
+                if (fix(sym->st_shndx) == 0)
+                {
+                    if (sym->st_name != 0) ++cost.imported;
+                }
+                else if ((sym->st_info >> 4) != 0)
+                {
+                    ++cost.exported;
+                }
+            }
+        }
+    }
+
+    template <typename E>
+    std::optional<DynamicView> parse() const
+    {
+        auto l = layout<E>();
+        if (!l) return std::nullopt;
+
+        DynamicView out;
+        out.arch = {l->ehdr.e_ident[ELFIO::EI_CLASS], fix(l->ehdr.e_machine), fix(l->ehdr.e_flags)};
+        auto page_down = [](uint64_t v) { return v & ~(PAGE - 1); };
+        auto page_up = [](uint64_t v) { return (v + PAGE - 1) & ~(PAGE - 1); };
+        for (const auto& ph : l->loads)
+        {
+            const uint64_t vaddr = fix(ph.p_vaddr);
+            const uint64_t file_end = page_up(vaddr + fix(ph.p_filesz));
+            const uint64_t mem_end = page_up(vaddr + fix(ph.p_memsz));
+            const uint64_t size = mem_end - page_down(vaddr);
+            out.cost.load_size += size;
+
+            const uint32_t flags = fix(ph.p_flags);
+            if (flags & ELFIO::PF_W)
+            {
+                // ld.so maps file pages up to the one holding p_filesz, then anonymous zero pages.
+                out.footprint.data += std::min(file_end, mem_end) - page_down(vaddr);
+                out.footprint.bss += mem_end - std::min(file_end, mem_end);
+            }
+            else if (flags & ELFIO::PF_X) out.footprint.text += size;
+            else out.footprint.rodata += size;
+        }
+        if (l->relro)
+        {
+            // Like _dl_protect_relro: a partial last page stays writable.
+            const uint64_t start = page_down(fix(l->relro->p_vaddr));
+            const uint64_t end = page_down(fix(l->relro->p_vaddr) + fix(l->relro->p_memsz));
+            if (end > start) out.footprint.relro = end - start;
+        }
+        if (!l->has_dynamic) return out;
+
+        read_link_cost(*l, out.cost);
+
+        const auto soname_idx = l->tag(ELFIO::DT_SONAME);
+        const auto rpath_idx = l->tag(ELFIO::DT_RPATH);
+        const auto runpath_idx = l->tag(ELFIO::DT_RUNPATH);
+        if (l->needed.empty() && !soname_idx && !rpath_idx && !runpath_idx) return out;
+
+        const auto strtab = string_table(*l);
+        if (!strtab) return std::nullopt;
+        const auto [str_off, strsz] = *strtab;
+
+        for (const auto idx : l->needed)
+        {
+            auto s = string_at(str_off, strsz, idx);
+            if (!s) return std::nullopt;
+            out.needed.push_back(*s);
+        }
+
+        auto assign = [&](const std::optional<uint64_t>& idx, std::string_view& dst)
+        {
+            if (!idx) return true;
+            auto s = string_at(str_off, strsz, *idx);
+            if (s) dst = *s;
+            return s.has_value();
+        };
+        if (!assign(soname_idx, out.soname) || !assign(rpath_idx, out.rpath) || !assign(runpath_idx, out.runpath))
+            return std::nullopt;
+
+        return out;
+    }
+
+    // Version index -> name, from both the versions this object defines (DT_VERDEF) and the
+    // ones it requires from others (DT_VERNEED).
+    template <typename E>
+    std::unordered_map<uint16_t, std::string_view> version_names(const Layout<E>& l, uint64_t str_off, uint64_t strsz) const
+    {
+        std::unordered_map<uint16_t, std::string_view> names;
+
+        if (auto verdef = offset_of(l, DT_VERDEF))
+        {
+            uint64_t off = *verdef;
+            for (uint64_t i = 0; i < l.tag(DT_VERDEFNUM).value_or(0); ++i)
+            {
+                // Elf_Verdef: vd_version, vd_flags, vd_ndx, vd_cnt (u16), vd_hash, vd_aux, vd_next (u32)
+                auto ndx = read<uint16_t>(off + 4);
+                auto aux = read<uint32_t>(off + 12);
+                auto next = read<uint32_t>(off + 16);
+                if (!ndx || !aux || !next) break;
+                if (auto name_idx = read<uint32_t>(off + fix(*aux)))
+                {
+                    if (auto name = string_at(str_off, strsz, fix(*name_idx))) names[fix(*ndx) & 0x7fff] = *name;
+                }
+                if (fix(*next) == 0) break;
+                off += fix(*next);
+            }
+        }
+
+        if (auto verneed = offset_of(l, DT_VERNEED))
+        {
+            uint64_t off = *verneed;
+            for (uint64_t i = 0; i < l.tag(DT_VERNEEDNUM).value_or(0); ++i)
+            {
+                // Elf_Verneed: vn_version, vn_cnt (u16), vn_file, vn_aux, vn_next (u32)
+                auto cnt = read<uint16_t>(off + 2);
+                auto aux = read<uint32_t>(off + 8);
+                auto next = read<uint32_t>(off + 12);
+                if (!cnt || !aux || !next) break;
+
+                uint64_t aux_off = off + fix(*aux);
+                for (uint16_t j = 0; j < fix(*cnt); ++j)
+                {
+                    // Elf_Vernaux: vna_hash (u32), vna_flags, vna_other (u16), vna_name, vna_next (u32)
+                    auto other = read<uint16_t>(aux_off + 6);
+                    auto name_idx = read<uint32_t>(aux_off + 8);
+                    auto aux_next = read<uint32_t>(aux_off + 12);
+                    if (!other || !name_idx || !aux_next) break;
+                    if (auto name = string_at(str_off, strsz, fix(*name_idx))) names[fix(*other) & 0x7fff] = *name;
+                    if (fix(*aux_next) == 0) break;
+                    aux_off += fix(*aux_next);
+                }
+                if (fix(*next) == 0) break;
+                off += fix(*next);
+            }
+        }
+        return names;
+    }
+
+    // Relocation type ld.so copies a variable's initial value with, per e_machine; 0 if unknown.
+    static uint32_t copy_reloc_type(uint16_t machine)
+    {
+        switch (machine)
+        {
+        case 3:   // i386
+        case 62:  // x86-64
+            return 5;
+        case 2:   // SPARC
+        case 18:  // SPARC32PLUS
+        case 20:  // PowerPC
+        case 21:  // PowerPC64
+        case 43:  // SPARC V9
+            return 19;
+        case 8: return 126;     // MIPS
+        case 22: return 9;      // S/390
+        case 40: return 20;     // ARM
+        case 183: return 1024;  // AArch64
+        case 243:               // RISC-V
+        case 258:               // LoongArch
+            return 4;
+        default: return 0;
+        }
+    }
+
+    // Indices of the dynamic symbols named by copy relocations (R_*_COPY in DT_RELA or DT_REL).
+    // The relative relocations DT_RELACOUNT/DT_RELCOUNT put first are skipped.
+    template <typename E>
+    std::unordered_set<uint64_t> copy_targets(const Layout<E>& l) const
+    {
+        std::unordered_set<uint64_t> out;
+        const uint32_t copy_type = copy_reloc_type(fix(l.ehdr.e_machine));
+        if (copy_type == 0) return out;
+
+        using Word = std::conditional_t<E::WORD == 8, uint64_t, uint32_t>;
+        auto scan = [&](int64_t table, int64_t size_tag, int64_t ent_tag, uint64_t default_ent, int64_t count_tag)
+        {
+            const auto offset = offset_of(l, table);
+            const uint64_t ent = l.tag(ent_tag).value_or(default_ent);
+            if (!offset || ent < 2 * E::WORD) return;
+            const uint64_t count = l.tag(size_tag).value_or(0) / ent;
+            for (uint64_t i = std::min(count, l.tag(count_tag).value_or(0)); i < count; ++i)
+            {
+                // Elf_Rel and Elf_Rela both start with r_offset, r_info.
+                auto info = read<Word>(*offset + i * ent + E::WORD);
+                if (!info) break;
+                const uint64_t r_info = fix(*info);
+                const uint64_t type = E::WORD == 8 ? r_info & 0xffffffff : r_info & 0xff;
+                const uint64_t sym = E::WORD == 8 ? r_info >> 32 : r_info >> 8;
+                if (type == copy_type) out.insert(sym);
+            }
+        };
+        scan(DT_RELA, DT_RELASZ, DT_RELAENT, 3 * E::WORD, DT_RELACOUNT);
+        scan(DT_REL, DT_RELSZ, DT_RELENT, 2 * E::WORD, DT_RELCOUNT);
+        return out;
+    }
+
+    template <typename E>
+    std::optional<SymbolTable> parse_symbols() const
+    {
+        auto l = layout<E>();
+        if (!l) return std::nullopt;
+
+        SymbolTable out;
+        if (!l->has_dynamic) return out;
+
+        const auto symtab = offset_of(*l, DT_SYMTAB);
+        const auto strtab = string_table(*l);
+        if (!symtab || !strtab) return out;
+        const auto [str_off, strsz] = *strtab;
+
+        const auto versions = version_names(*l, str_off, strsz);
+        const auto versym = offset_of(*l, DT_VERSYM);
+        const uint64_t syment = l->tag(DT_SYMENT).value_or(sizeof(typename E::Sym));
+        if (syment < sizeof(typename E::Sym)) return std::nullopt;
+
+        const auto copied = copy_targets(*l);
+        const uint64_t count = symbol_count(*l);
+        for (uint64_t i = 1; i < count; ++i)
+        {
+            auto sym = read<typename E::Sym>(*symtab + i * syment);
+            if (!sym) return std::nullopt;
+            const bool local = (sym->st_info >> 4) == 0;
+            if (local || sym->st_name == 0) continue;
+
+            auto name = string_at(str_off, strsz, fix(sym->st_name));
+            if (!name || name->empty()) continue;
+
+            const std::string_view* version = nullptr;
+            bool hidden = false;
+            if (versym)
+            {
+                auto idx = read<uint16_t>(*versym + i * 2);
+                if (idx)
+                {
+                    if (const auto it = versions.find(fix(*idx) & 0x7fff); it != versions.end() && it->first > 1)
+                    {
+                        version = &it->second;
+                        // A non-default version (name@VER, not name@@VER): unversioned references skip it.
+                        hidden = (fix(*idx) & 0x8000) != 0;
+                    }
+                }
+            }
+            auto versioned = [&] { return version ? std::format("{}@{}", *name, *version) : std::string(*name); };
+
+            if (fix(sym->st_shndx) == 0)
+            {
+                out.imports.push_back(versioned());
+                continue;
+            }
+
+            // The target of a copy relocation: ld.so fills it from the next object in scope
+            // that defines it.
+            if (copied.contains(i)) out.copies.push_back(versioned());
+            if (!version) out.definitions.push_back(*out.exports.emplace(*name).first);
+            else
+            {
+                if (!hidden) out.exports.emplace(*name);
+                const auto full = out.exports.insert(versioned()).first;
+                // The linker defines an absolute symbol named after each version node.
+                const bool version_node = fix(sym->st_shndx) == SHN_ABS && *name == *version;
+                if (!version_node) out.definitions.push_back(*full);
+            }
+        }
+        out.build_bloom();
+        return out;
+    }
+
+public:
+    explicit MappedElf(const std::string& path) : file(path), image(file.bytes()) {}
+
+    bool is_mapped() const { return file.is_mapped(); }
+
+    // Checks the ELF identification and sets the byte order; returns the ELF class.
+    std::optional<unsigned char> identify()
+    {
+        if (!is_mapped() || image.size() < 16) return std::nullopt;
+
+        const auto* ident = reinterpret_cast<const unsigned char*>(image.data());
+        if (ident[0] != 0x7f || ident[1] != 'E' || ident[2] != 'L' || ident[3] != 'F') return std::nullopt;
+
+        const unsigned char data = ident[ELFIO::EI_DATA];
+        if (data != ELFIO::ELFDATA2LSB && data != ELFIO::ELFDATA2MSB) return std::nullopt;
+        swap = (data == ELFIO::ELFDATA2LSB) != (std::endian::native == std::endian::little);
+        return ident[ELFIO::EI_CLASS];
+    }
+
+    // Follows the program headers to PT_DYNAMIC and DT_STRTAB. Returns nullopt if the
+    // file is not an ELF image we can read this way (the caller should fall back to ELFIO).
+    std::optional<DynamicView> read_dynamic()
+    {
+        switch (identify().value_or(0))
+        {
+        case ELFIO::ELFCLASS32: return parse<Elf32>();
+        case ELFIO::ELFCLASS64: return parse<Elf64>();
+        default: return std::nullopt;
+        }
+    }
+
+    std::optional<SymbolTable> read_symbols()
+    {
+        switch (identify().value_or(0))
+        {
+        case ELFIO::ELFCLASS32: return parse_symbols<Elf32>();
+        case ELFIO::ELFCLASS64: return parse_symbols<Elf64>();
+        default: return std::nullopt;
+        }
+    }
+};
+
+struct DynamicInfo
+{
+    ElfArch arch;
+    LinkCost cost;
+    Footprint footprint;
+    std::vector<std::string> needed;
+    std::string soname;
+    std::string rpath;
+    std::string runpath;
+};
+
+std::optional<DynamicInfo> read_dynamic_info(const std::string& path)
+{
+    Stats::Scope scope(Stats::PARSE, path);
+    Stats::count(Stats::FILES_PARSED);
+    {
+        MappedElf elf(path);
+        if (auto view = elf.read_dynamic())
+        {
+            return DynamicInfo{
+                view->arch,
+                view->cost,
+                view->footprint,
+                view->needed | r::to<std::vector<std::string>>(),
+                std::string(view->soname),
+                std::string(view->rpath),
+                std::string(view->runpath)
+            };
+        }
+    }
+
+    // Fallback for images the program-header walk can't handle. ELFIO reads from a stream over
+    // the mapping, so archive members work too.
+    MappedFile file(path);
+    std::ispanstream stream(std::span<const char>(file.bytes()));
+    ELFIO::elfio reader;
+    if (!file.is_mapped() || !reader.load(stream)) return std::nullopt;
+
+    DynamicInfo info;
+    info.arch = {reader.get_class(), reader.get_machine(), reader.get_flags()};
+    if (auto* dyn_sec = reader.sections[".dynamic"])
+    {
+        ELFIO::dynamic_section_accessor dyn(reader, dyn_sec);
+        for (ELFIO::Elf_Xword i = 0; i < dyn.get_entries_num(); ++i)
+        {
+            ELFIO::Elf_Xword tag, value;
+            std::string str;
+            dyn.get_entry(i, tag, value, str);
+            if (tag == ELFIO::DT_NEEDED) info.needed.push_back(str);
+            else if (tag == ELFIO::DT_SONAME) info.soname = str;
+            else if (tag == ELFIO::DT_RPATH) info.rpath = str;
+            else if (tag == ELFIO::DT_RUNPATH) info.runpath = str;
+        }
+    }
+    return info;
+}
+
+// Persistent cache of DynamicInfo keyed by file identity (st_dev, st_ino, st_mtim, st_size), so warm
+// runs only need one stat() per library. Layout, native byte order, mmapped read-only:
+//   Header | Entry[count] sorted by (dev, ino) | uint32_t needed[] | char strings[]
+class DynamicCache
+{
+    struct Header
+    {
+        char magic[8];
+        uint32_t byte_order;
+        uint32_t count;
+        uint64_t needed_offset;
+        uint64_t needed_count;
+        uint64_t strings_offset;
+        uint64_t strings_size;
+    };
+
+    struct Entry
+    {
+        uint64_t dev;
+        uint64_t ino;
+        int64_t mtime_sec;
+        int64_t mtime_nsec;
+        uint64_t size;
+        uint32_t needed_first;
+        uint32_t needed_count;
+        uint32_t soname;
+        uint32_t rpath;
+        uint32_t runpath;
+        uint32_t flags;
+        uint32_t e_flags;
+        uint16_t e_machine;
+        uint8_t elf_class;
+        uint8_t reserved;
+        LinkCost cost;
+        Footprint footprint;
+    };
+
+    static constexpr std::string_view MAGIC{"IDDYNC4\0", 8};
+    static constexpr uint32_t ENDIAN_TAG = 0x01020304;
+    // Entry::flags: the file was readable as ELF. Negative results are cached too.
+    static constexpr uint32_t PARSED = 1;
+
+    struct Record
+    {
+        Entry key;
+        std::optional<DynamicInfo> info;
+    };
+
+    std::string cache_path;
+    void* mmap_addr = MAP_FAILED;
+    size_t mmap_size = 0;
+    std::span<const Entry> entries;
+    std::span<const uint32_t> needed;
+    std::string_view strings;
+
+    std::mutex m;
+    std::vector<Record> fresh;
+
+    static bool same_file(const Entry& a, const Entry& b)
+    {
+        return a.mtime_sec == b.mtime_sec && a.mtime_nsec == b.mtime_nsec && a.size == b.size;
+    }
+
+    static bool key_less(const Entry& a, const Entry& b)
+    {
+        return std::tie(a.dev, a.ino) < std::tie(b.dev, b.ino);
+    }
+
+    std::optional<std::string> string_at(uint32_t off) const
+    {
+        if (off >= strings.size()) return std::nullopt;
+        const auto rest = strings.substr(off);
+        const auto end = rest.find('\0');
+        if (end == std::string_view::npos) return std::nullopt;
+        return std::string(rest.substr(0, end));
+    }
+
+    std::optional<std::optional<DynamicInfo>> decode(const Entry& e) const
+    {
+        if (!(e.flags & PARSED)) return std::optional<DynamicInfo>{};
+        if (e.needed_first > needed.size() || e.needed_count > needed.size() - e.needed_first) return std::nullopt;
+
+        DynamicInfo info;
+        info.arch = {e.elf_class, e.e_machine, e.e_flags};
+        info.cost = e.cost;
+        info.footprint = e.footprint;
+        for (const auto off : needed.subspan(e.needed_first, e.needed_count))
+        {
+            auto str = string_at(off);
+            if (!str) return std::nullopt;
+            info.needed.push_back(std::move(*str));
+        }
+        auto soname = string_at(e.soname);
+        auto rpath = string_at(e.rpath);
+        auto runpath = string_at(e.runpath);
+        if (!soname || !rpath || !runpath) return std::nullopt;
+        info.soname = std::move(*soname);
+        info.rpath = std::move(*rpath);
+        info.runpath = std::move(*runpath);
+        return std::optional<DynamicInfo>{std::move(info)};
+    }
+
+public:
+    explicit DynamicCache(std::string path) : cache_path(std::move(path))
+    {
+        const int fd = open(cache_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) return;
+
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header))
+        {
+            mmap_size = st.st_size;
+            mmap_addr = mmap(nullptr, mmap_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+
+        if (mmap_addr == MAP_FAILED) return;
+
+        const auto* base = static_cast<const char*>(mmap_addr);
+        const auto* header = reinterpret_cast<const Header*>(base);
+        if (std::string_view(header->magic, 8) != MAGIC || header->byte_order != ENDIAN_TAG) return;
+
+        const uint64_t entries_end = sizeof(Header) + static_cast<uint64_t>(header->count) * sizeof(Entry);
+        if (entries_end > mmap_size || header->needed_offset < entries_end ||
+            header->needed_offset % alignof(uint32_t) != 0 ||
+            header->needed_count > (mmap_size - header->needed_offset) / sizeof(uint32_t) ||
+            header->strings_offset > mmap_size || header->strings_size > mmap_size - header->strings_offset)
+            return;
+
+        entries = std::span(reinterpret_cast<const Entry*>(base + sizeof(Header)), header->count);
+        needed = std::span(reinterpret_cast<const uint32_t*>(base + header->needed_offset), header->needed_count);
+        strings = std::string_view(base + header->strings_offset, header->strings_size);
+    }
+
+    DynamicCache(const DynamicCache&) = delete;
+    DynamicCache& operator=(const DynamicCache&) = delete;
+
+    ~DynamicCache()
+    {
+        if (mmap_addr != MAP_FAILED) munmap(mmap_addr, mmap_size);
+    }
+
+    static std::optional<std::string> default_path()
+    {
+        if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+            return (fs::path(xdg) / "inspect-deps" / "dynamic.cache").string();
+        if (const char* home = std::getenv("HOME"); home && *home)
+            return (fs::path(home) / ".cache" / "inspect-deps" / "dynamic.cache").string();
+        return std::nullopt;
+    }
+
+    std::optional<DynamicInfo> load(const std::string& path)
+    {
+        struct stat st{};
+        Stats::count(Stats::STAT_CALLS);
+        if (stat(path.c_str(), &st) != 0) return read_dynamic_info(path);
+
+        Entry key{};
+        key.dev = st.st_dev;
+        key.ino = st.st_ino;
+        key.mtime_sec = st.st_mtim.tv_sec;
+        key.mtime_nsec = st.st_mtim.tv_nsec;
+        key.size = st.st_size;
+
+        if (const auto it = r::lower_bound(entries, key, key_less); it != entries.end() && !key_less(key, *it))
+        {
+            if (same_file(*it, key))
+            {
+                if (auto hit = decode(*it))
+                {
+                    Stats::count(Stats::DISK_CACHE_HITS);
+                    return *hit;
+                }
+            }
+        }
+
+        Stats::count(Stats::DISK_CACHE_MISSES);
+        auto info = read_dynamic_info(path);
+        key.flags = info ? PARSED : 0;
+        std::lock_guard lock(m);
+        fresh.push_back({key, info});
+        return info;
+    }
+
+    // Merges new records into the mapped table and atomically replaces the cache file.
+    void save()
+    {
+        Stats::Scope scope(Stats::CACHE_SAVE);
+        std::lock_guard lock(m);
+        if (fresh.empty()) return;
+
+        std::vector<Record> records = std::move(fresh);
+        fresh.clear();
+        r::sort(records, key_less, &Record::key);
+        auto dup = r::unique(records, [](const Record& a, const Record& b)
+        {
+            return !key_less(a.key, b.key) && !key_less(b.key, a.key);
+        });
+        records.erase(dup.begin(), dup.end());
+
+        for (const auto& e : entries)
+        {
+            if (r::binary_search(records, e, key_less, &Record::key)) continue;
+            if (auto info = decode(e)) records.push_back({e, std::move(*info)});
+        }
+        r::sort(records, key_less, &Record::key);
+
+        std::string string_table(1, '\0');
+        std::unordered_map<std::string, uint32_t> string_index{{"", 0}};
+        auto intern = [&](const std::string& str)
+        {
+            auto [it, inserted] = string_index.try_emplace(str, static_cast<uint32_t>(string_table.size()));
+            if (inserted)
+            {
+                string_table += str;
+                string_table += '\0';
+            }
+            return it->second;
+        };
+
+        std::vector<Entry> out_entries;
+        std::vector<uint32_t> out_needed;
+        for (auto& [e, info] : records)
+        {
+            Entry out = e;
+            out.needed_first = static_cast<uint32_t>(out_needed.size());
+            out.needed_count = 0;
+            out.soname = out.rpath = out.runpath = 0;
+            out.flags = info ? PARSED : 0;
+            if (info)
+            {
+                for (const auto& n : info->needed) out_needed.push_back(intern(n));
+                out.needed_count = static_cast<uint32_t>(info->needed.size());
+                out.soname = intern(info->soname);
+                out.rpath = intern(info->rpath);
+                out.runpath = intern(info->runpath);
+                out.e_flags = info->arch.flags;
+                out.e_machine = info->arch.machine;
+                out.elf_class = info->arch.elf_class;
+                out.cost = info->cost;
+                out.footprint = info->footprint;
+            }
+            out_entries.push_back(out);
+        }
+
+        Header header{};
+        std::memcpy(header.magic, MAGIC.data(), MAGIC.size());
+        header.byte_order = ENDIAN_TAG;
+        header.count = static_cast<uint32_t>(out_entries.size());
+        header.needed_offset = sizeof(Header) + out_entries.size() * sizeof(Entry);
+        header.needed_count = out_needed.size();
+        header.strings_offset = header.needed_offset + out_needed.size() * sizeof(uint32_t);
+        header.strings_size = string_table.size();
+
+        std::error_code ec;
+        fs::create_directories(fs::path(cache_path).parent_path(), ec);
+        const std::string tmp = std::format("{}.{}.tmp", cache_path, getpid());
+        {
+            std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+            f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            f.write(reinterpret_cast<const char*>(out_entries.data()),
+                    static_cast<std::streamsize>(out_entries.size() * sizeof(Entry)));
+            f.write(reinterpret_cast<const char*>(out_needed.data()),
+                    static_cast<std::streamsize>(out_needed.size() * sizeof(uint32_t)));
+            f.write(string_table.data(), static_cast<std::streamsize>(string_table.size()));
+            if (!f)
+            {
+                fs::remove(tmp, ec);
+                return;
+            }
+        }
+        fs::rename(tmp, cache_path, ec);
+        if (ec) fs::remove(tmp, ec);
+    }
+};
+
+// Work-stealing pool: each worker pops its own deque LIFO and steals FIFO from the others.
+class WorkStealingPool
+{
+    struct Queue
+    {
+        std::mutex m;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex m;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+    size_t queued = 0;
+    size_t pending = 0;
+    bool stopping = false;
+    std::atomic<size_t> next_queue = 0;
+
+    inline static thread_local const WorkStealingPool* owner = nullptr;
+    inline static thread_local size_t self = 0;
+
+    std::optional<std::function<void()>> take(size_t idx)
+    {
+        for (size_t k = 0; k < queues.size(); ++k)
+        {
+            auto& q = *queues[(idx + k) % queues.size()];
+            std::lock_guard lock(q.m);
+            if (q.tasks.empty()) continue;
+
+            std::function<void()> task;
+            if (k == 0)
+            {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+            return task;
+        }
+        return std::nullopt;
+    }
+
+    void run(size_t idx)
+    {
+        owner = this;
+        self = idx;
+        while (true)
+        {
+            {
+                std::unique_lock lock(m);
+                work_cv.wait(lock, [&] { return stopping || queued > 0; });
+                if (queued == 0) return;
+                --queued;
+            }
+
+            // A queued task is reserved for us, it just may sit in another worker's deque.
+            std::optional<std::function<void()>> task;
+            while (!(task = take(idx))) std::this_thread::yield();
+            (*task)();
+
+            std::lock_guard lock(m);
+            if (--pending == 0) done_cv.notify_all();
+        }
+    }
+
+public:
+    explicit WorkStealingPool(size_t n)
+    {
+        n = std::max<size_t>(n, 1);
+        for (size_t i = 0; i < n; ++i) queues.push_back(std::make_unique<Queue>());
+        for (size_t i = 0; i < n; ++i) workers.emplace_back([this, i] { run(i); });
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard lock(m);
+            stopping = true;
+        }
+        work_cv.notify_all();
+        for (auto& w : workers) w.join();
+    }
+
+    void submit(std::function<void()> task)
+    {
+        const size_t idx = owner == this ? self : next_queue++ % queues.size();
+        {
+            std::lock_guard lock(queues[idx]->m);
+            queues[idx]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard lock(m);
+            ++queued;
+            ++pending;
+        }
+        work_cv.notify_one();
+    }
+
+    void wait()
+    {
+        std::unique_lock lock(m);
+        done_cv.wait(lock, [&] { return pending == 0; });
+    }
+};
+
+// String-keyed map sharded by hash so concurrent writers rarely contend.
+template <typename V>
+class ConcurrentMap
+{
+    static constexpr size_t SHARDS = 64;
+
+    struct Shard
+    {
+        std::mutex m;
+        std::unordered_map<std::string, V> map;
+    };
+
+    std::array<Shard, SHARDS> shards;
+
+    Shard& shard(const std::string& key) { return shards[std::hash<std::string>{}(key) % SHARDS]; }
+
+public:
+    bool insert(const std::string& key, V value)
+    {
+        auto& s = shard(key);
+        std::lock_guard lock(s.m);
+        return s.map.try_emplace(key, std::move(value)).second;
+    }
+
+    std::optional<V> find(const std::string& key)
+    {
+        auto& s = shard(key);
+        std::lock_guard lock(s.m);
+        if (const auto it = s.map.find(key); it != s.map.end()) return it->second;
+        return std::nullopt;
+    }
+
+    template <typename Pred>
+    void erase_if(Pred&& pred)
+    {
+        for (auto& s : shards)
+        {
+            std::lock_guard lock(s.m);
+            std::erase_if(s.map, [&](const auto& kv) { return pred(kv.first, kv.second); });
+        }
+    }
+
+    void clear()
+    {
+        erase_if([](const auto&, const auto&) { return true; });
+    }
+
+    template <typename F>
+    void for_each(F&& f)
+    {
+        for (auto& s : shards)
+        {
+            std::lock_guard lock(s.m);
+            for (const auto& [k, val] : s.map) f(k, val);
+        }
+    }
+
+    // The value is computed outside the lock; if two threads race, the first insert wins.
+    template <typename F>
+    V get_or_compute(const std::string& key, F&& compute)
+    {
+        if (auto hit = find(key)) return *hit;
+        V value = compute();
+        auto& s = shard(key);
+        std::lock_guard lock(s.m);
+        return s.map.try_emplace(key, std::move(value)).first->second;
+    }
+};
+
+using NodeId = uint32_t;
+
+// Physical identity of a file; hard and symbolic links to one file share it.
+struct FileId
+{
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+
+    bool operator==(const FileId&) const = default;
+};
+
+struct FileIdHash
+{
+    size_t operator()(const FileId& f) const
+    {
+        return std::hash<uint64_t>{}(f.ino ^ (f.dev * 0x9e3779b97f4a7c15ull));
+    }
+};
+
+// Size and 64-bit digest of a file's bytes, for recognizing byte-identical copies of a library
+// (the same base layer in many images). Four multiply-rotate lanes; not cryptographic.
+std::optional<std::string> content_digest(const std::string& path)
+{
+    MappedFile file(path);
+    if (!file.is_mapped()) return std::nullopt;
+    file.sequential();
+    const size_t size = file.bytes().size();
+
+    constexpr uint64_t K = 0x9e3779b97f4a7c15ull;
+    const auto* bytes = reinterpret_cast<const unsigned char*>(file.bytes().data());
+    std::array<uint64_t, 4> lanes = {K, ~K, K * 3, K * 5};
+    auto mix = [](uint64_t lane, uint64_t word) { return std::rotl((lane ^ word) * K, 29); };
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        for (size_t l = 0; l < 4; ++l)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + i + l * 8, 8);
+            lanes[l] = mix(lanes[l], word);
+        }
+    }
+    for (; i < size; i += 8)
+    {
+        uint64_t word = 0;
+        std::memcpy(&word, bytes + i, std::min<size_t>(8, size - i));
+        lanes[0] = mix(lanes[0], word);
+    }
+
+    uint64_t h = size;
+    for (const auto lane : lanes) h = mix(h, lane);
+    h ^= h >> 32;
+    return std::format("{:x}#{:016x}", size, h);
+}
+
+// Compressed sparse row adjacency: the neighbours of node n are ids[offsets[n], offsets[n + 1]).
+struct Adjacency
+{
+    std::vector<uint32_t> offsets;
+    std::vector<NodeId> ids;
+
+    // Counting sort by source; edges keep their insertion order within each node.
+    static Adjacency from_edges(size_t node_count, const std::vector<std::pair<NodeId, NodeId>>& edges)
+    {
+        Adjacency adj;
+        adj.offsets.assign(node_count + 1, 0);
+        for (const auto& [from, to] : edges) adj.offsets[from + 1]++;
+        for (size_t i = 0; i < node_count; ++i) adj.offsets[i + 1] += adj.offsets[i];
+
+        adj.ids.resize(edges.size());
+        std::vector<uint32_t> fill(adj.offsets.begin(), adj.offsets.end() - 1);
+        for (const auto& [from, to] : edges) adj.ids[fill[from]++] = to;
+        return adj;
+    }
+
+    std::span<const NodeId> operator[](NodeId n) const
+    {
+        if (n + 1 >= offsets.size()) return {};
+        return std::span(ids).subspan(offsets[n], offsets[n + 1] - offsets[n]);
+    }
+};
+
+struct Node
+{
+    std::string path;
+    std::string pkg;
+    int depth = 0;
+};
+
+std::vector<std::string> split_path(std::string_view s)
+{
+    if (s.empty()) return {};
+    return s | v::split(':')
+        | v::transform([](auto&& rng)
+        {
+            auto str = std::string(rng.begin(), rng.end());
+            return str.empty() ? "." : str;
+        })
+        | r::to<std::vector<std::string>>();
+}
+
+// ld.so takes relative search path entries (and the "." of an empty one) from the working
+// directory. Directories are cache keys, and the daemon serves clients in different directories,
+// so they are made absolute first. An image has no working directory of ours: under --sysroot
+// they are taken from its root.
+std::string absolute_dir(const std::string& dir)
+{
+    if (dir.starts_with('/')) return dir;
+    std::error_code ec;
+    auto abs = Sysroot::active() ? Sysroot::host((fs::path("/") / dir).lexically_normal().string())
+                                 : (fs::current_path(ec) / dir).lexically_normal().string();
+    if (abs.size() > 1 && abs.ends_with('/')) abs.pop_back();
+    return abs;
+}
+
+// Entry names of each library search directory, read once with readdir (getdents64 underneath)
+// instead of one stat per candidate. Missing directories are remembered as empty, the canonical
+// path of every directory is resolved once, and symlinked entries are canonicalized on first use.
+class DirectoryCache
+{
+    struct Listing
+    {
+        bool listed = false;
+        std::string canonical;
+        std::unordered_map<std::string, unsigned char> entries;
+    };
+
+    std::mutex m;
+    std::unordered_map<std::string, std::shared_ptr<const Listing>> dirs;
+    ConcurrentMap<std::optional<std::string>> links;
+
+    static std::shared_ptr<const Listing> read_listing(const std::string& dir)
+    {
+        auto listing = std::make_shared<Listing>();
+        Stats::count(Stats::DIRS_LISTED);
+        auto canonical = Sysroot::canonical(dir);
+        if (!canonical) return listing;
+        if (const auto* entries = Sysroot::listing(*canonical))
+        {
+            listing->canonical = std::move(*canonical);
+            listing->entries.insert(entries->begin(), entries->end());
+            listing->listed = true;
+            return listing;
+        }
+        DIR* d = opendir(canonical->c_str());
+        if (!d) return listing;
+        listing->canonical = std::move(*canonical);
+
+        while (const dirent* e = readdir(d))
+        {
+            listing->entries.emplace(e->d_name, e->d_type);
+        }
+        closedir(d);
+        listing->listed = true;
+        return listing;
+    }
+
+    std::shared_ptr<const Listing> listing(const std::string& dir)
+    {
+        {
+            std::lock_guard lock(m);
+            if (const auto it = dirs.find(dir); it != dirs.end()) return it->second;
+        }
+        auto fresh = read_listing(dir);
+        std::lock_guard lock(m);
+        return dirs.try_emplace(dir, std::move(fresh)).first->second;
+    }
+
+public:
+    // Drops the listings of `changed` directories and every memoized symlink target.
+    void invalidate(const std::unordered_set<std::string>& changed)
+    {
+        {
+            std::lock_guard lock(m);
+            std::erase_if(dirs, [&](const auto& kv) { return changed.contains(kv.first); });
+        }
+        links.clear();
+    }
+
+    // Missing directories can't be watched, so they are simply looked up again.
+    void forget_missing()
+    {
+        std::lock_guard lock(m);
+        std::erase_if(dirs, [](const auto& kv) { return !kv.second->listed; });
+    }
+
+    std::vector<std::string> listed_dirs()
+    {
+        std::lock_guard lock(m);
+        std::vector<std::string> out;
+        for (const auto& [dir, l] : dirs)
+        {
+            if (l->listed) out.push_back(dir);
+        }
+        return out;
+    }
+
+    // Same answer as `exists(dir / name) ? canonical(dir / name) : nullopt`.
+    std::optional<std::string> find(const std::string& dir, const std::string& name)
+    {
+        fs::path p = fs::path(dir) / name;
+        if (name.find('/') != std::string::npos || name == "." || name == "..")
+        {
+            Stats::count(Stats::STAT_CALLS);
+            return Sysroot::canonical(p.string());
+        }
+
+        const auto l = listing(dir);
+        if (!l->listed)
+        {
+            // Search-only (--x) directories can't be listed but can still be probed.
+            Stats::count(Stats::STAT_CALLS);
+            return Sysroot::canonical(p.string());
+        }
+
+        const auto it = l->entries.find(name);
+        if (it == l->entries.end()) return std::nullopt;
+        if (it->second == DT_REG || it->second == DT_DIR) return (fs::path(l->canonical) / name).string();
+
+        return links.get_or_compute(l->canonical + '/' + name, [&]
+        {
+            Stats::count(Stats::STAT_CALLS);
+            return Sysroot::canonical(l->canonical + '/' + name);
+        });
+    }
+};
+
+// Per-file results keyed by LibraryCache::file_key(). The caches of several --sysroot images
+// share one, so a library present in all of them is parsed once.
+struct FileResults
+{
+    ConcurrentMap<std::optional<DynamicInfo>> parsed;
+    ConcurrentMap<std::shared_ptr<const SymbolTable>> symbols;
+};
+
+// System lookups and per-file results shared by every graph built in this process (or, under
+// --sysroot, for one image).
+struct LibraryCache
+{
+    LdCache ld_cache;
+    AlpmManager alpm;
+    DirectoryCache dirs;
+    ConcurrentMap<std::optional<FileId>> identities;
+    ConcurrentMap<std::optional<std::string>> digests;
+    ConcurrentMap<std::optional<std::string>> resolved;
+    ConcurrentMap<bool> visited;
+    std::shared_ptr<FileResults> files = std::make_shared<FileResults>();
+    bool content_keys = false;
+    std::unique_ptr<DynamicCache> disk;
+
+    LibraryCache() = default;
+    explicit LibraryCache(std::shared_ptr<FileResults> shared) : files(std::move(shared)), content_keys(true) {}
+
+    std::optional<FileId> identity(const std::string& path)
+    {
+        return identities.get_or_compute(path, [&]() -> std::optional<FileId>
+        {
+            struct stat st{};
+            Stats::count(Stats::STAT_CALLS);
+            if (!Sysroot::stat(path, st)) return std::nullopt;
+            return FileId{static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino)};
+        });
+    }
+
+    // Key for per-file results, so every name of one file shares a single parse. Results shared
+    // between images are keyed by content instead, as each image has its own copy.
+    std::string file_key(const std::string& path)
+    {
+        if (content_keys)
+        {
+            if (auto digest = digests.get_or_compute(path, [&] { return content_digest(path); })) return *digest;
+        }
+        if (auto id = identity(path)) return std::format("{}:{}", id->dev, id->ino);
+        return path;
+    }
+
+    std::optional<DynamicInfo> read(const std::string& path) const
+    {
+        return disk ? disk->load(path) : read_dynamic_info(path);
+    }
+
+    // Dynamic symbols are only needed by --unused and --interpose; each library is read once and shared.
+    std::shared_ptr<const SymbolTable> symbol_table(const std::string& path)
+    {
+        return files->symbols.get_or_compute(file_key(path), [&]() -> std::shared_ptr<const SymbolTable>
+        {
+            Stats::Scope scope(Stats::SYMBOLS, path);
+            MappedElf elf(path);
+            auto table = elf.read_symbols();
+            return table ? std::make_shared<const SymbolTable>(std::move(*table)) : nullptr;
+        });
+    }
+
+    void open_disk_cache()
+    {
+        // Entries are keyed by inode, which archive members don't have.
+        if (Sysroot::archived()) return;
+        if (auto path = DynamicCache::default_path())
+        {
+            disk = std::make_unique<DynamicCache>(*path);
+            // The index describes the host's pacman DB.
+            if (!Sysroot::active()) alpm.use_index((fs::path(*path).parent_path() / "packages.index").string());
+        }
+    }
+
+    void save_disk_cache()
+    {
+        if (disk) disk->save();
+    }
+
+    // Forgets everything derived from files in `changed` directories. Resolutions are cheap to
+    // redo from the directory listings, so they are dropped wholesale.
+    void invalidate(const std::unordered_set<std::string>& changed)
+    {
+        auto in_changed = [&](const std::string& path)
+        {
+            return changed.contains(fs::path(path).parent_path().string());
+        };
+        std::unordered_set<std::string> stale;
+        identities.for_each([&](const std::string& path, const std::optional<FileId>& id)
+        {
+            if (!in_changed(path)) return;
+            stale.insert(path);
+            if (id) stale.insert(std::format("{}:{}", id->dev, id->ino));
+        });
+        auto is_stale = [&](const std::string& key, const auto&) { return stale.contains(key); };
+        identities.erase_if(is_stale);
+        files->parsed.erase_if(is_stale);
+        files->symbols.erase_if(is_stale);
+        dirs.invalidate(changed);
+        resolved.clear();
+        visited.clear();
+    }
+};
+
+struct DepGraph
+{
+    // Node i is one file (or one unresolved name), labelled names[i] after the DT_NEEDED entry
+    // that first reached it. Edges are stored as CSR arrays once the walk is done.
+    std::vector<std::string> names;
+    std::vector<char> ambiguous;
+    // Label -> first node carrying it, and other names a node was reached by, for find().
+    std::unordered_map<std::string, NodeId> labels;
+    std::unordered_map<std::string, NodeId> aliases;
+    std::vector<Node> nodes;
+    Adjacency children;
+    Adjacency parents;
+    NodeId root = 0;
+    std::string root_name;
+    std::shared_ptr<LibraryCache> cache;
+    std::vector<std::string> ld_paths;
+
+    DepGraph() : cache(std::make_shared<LibraryCache>()) {}
+    explicit DepGraph(std::shared_ptr<LibraryCache> shared) : cache(std::move(shared)) {}
+
+    std::optional<std::string> resolve_library(
+        const std::string& name,
+        const std::vector<std::string>& rpaths,
+        const std::vector<std::string>& runpaths,
+        const std::vector<std::string>& inherited_rpaths,
+        const ElfArch& arch = {}) const
+    {
+        std::vector<std::string> search_paths;
+
+        // 1. RPATH (if no RUNPATH)
+        if (runpaths.empty())
+        {
+            search_paths.append_range(rpaths);
+            search_paths.append_range(inherited_rpaths);
+        }
+
+        // 2. LD_LIBRARY_PATH
+        search_paths.append_range(ld_paths);
+
+        // 3. RUNPATH
+        search_paths.append_range(runpaths);
+
+        for (const auto& dir : search_paths)
+        {
+            if (auto hit = cache->dirs.find(dir, name)) return hit;
+        }
+
+        // 4. LdCache
+        if (auto res = cache->ld_cache.resolve(name, arch))
+        {
+            if (!Sysroot::active()) return *res;
+            if (auto in_root = Sysroot::canonical(Sysroot::host(*res))) return in_root;
+        }
+
+        // 5. Default paths
+        constexpr std::array<std::string_view, 4> defaults = {"/lib", "/usr/lib", "/lib64", "/usr/lib64"};
+        for (const auto& dir : defaults)
+        {
+            if (auto hit = cache->dirs.find(Sysroot::host(dir), name)) return hit;
+        }
+
+        return std::nullopt;
+    }
+
+    // Children and search paths of one object, as seen from the parent that reached it.
+    struct Expanded
+    {
+        ElfArch arch;
+        std::vector<std::string> children;
+        std::vector<std::string> rpaths;
+        std::vector<std::string> runpaths;
+        std::vector<std::string> next_inherited;
+    };
+
+    static Expanded expand(const std::string& path, const DynamicInfo& dyn,
+                           const std::vector<std::string>& inherited, bool show_stdlib)
+    {
+        Expanded out;
+        out.arch = dyn.arch;
+        out.rpaths = split_path(dyn.rpath);
+        out.runpaths = split_path(dyn.runpath);
+
+        std::string origin = fs::path(path).parent_path().string();
+        // Absolute entries are looked up inside --sysroot; $ORIGIN is a host path already.
+        auto expand_origin = [&](std::string& p)
+        {
+            p = Sysroot::host(p);
+            size_t pos = 0;
+            while ((pos = p.find("$ORIGIN", pos)) != std::string::npos)
+            {
+                p.replace(pos, 7, origin);
+                pos += origin.length();
+            }
+            p = absolute_dir(p);
+        };
+        for (auto& p : out.rpaths) expand_origin(p);
+        for (auto& p : out.runpaths) expand_origin(p);
+
+        if (out.runpaths.empty())
+        {
+            out.next_inherited = out.rpaths;
+            out.next_inherited.append_range(inherited);
+        }
+
+        for (const auto& lib : v::reverse(dyn.needed))
+        {
+            if (r::any_of(NOISE_PREFIX, [&](const auto& p) { return lib.starts_with(p); })) continue;
+            if (!show_stdlib && r::any_of(GLIBC_PREFIX, [&](const auto& p) { return lib.starts_with(p); }))
+                continue;
+
+            if (r::find(out.children, lib) == out.children.end())
+            {
+                out.children.push_back(lib);
+            }
+        }
+        r::reverse(out.children);
+        return out;
+    }
+
+    static std::string context_key(const std::string& name, std::initializer_list<const std::vector<std::string>*> lists)
+    {
+        std::string key = name;
+        for (const auto* list : lists)
+        {
+            key += '\0';
+            for (const auto& p : *list)
+            {
+                key += p;
+                key += '\n';
+            }
+        }
+        return key;
+    }
+
+    std::optional<DynamicInfo> load_dynamic(const std::string& path)
+    {
+        const auto key = cache->file_key(path);
+        if (auto hit = cache->files->parsed.find(key))
+        {
+            Stats::count(Stats::PARSE_CACHE_HITS);
+            return *hit;
+        }
+        Stats::count(Stats::PARSE_CACHE_MISSES);
+        return cache->files->parsed.get_or_compute(key, [&] { return cache->read(path); });
+    }
+
+    std::optional<std::string> resolve_cached(const std::string& name, const Expanded& ex,
+                                              const std::vector<std::string>& inherited)
+    {
+        const auto arch_key = std::format(
+            "{}\n{}:{}:{}", name, static_cast<int>(ex.arch.elf_class), ex.arch.machine, ex.arch.flags);
+        const auto key = context_key(arch_key, {&ex.rpaths, &ex.runpaths, &inherited, &ld_paths});
+        if (auto hit = cache->resolved.find(key))
+        {
+            Stats::count(Stats::RESOLVE_CACHE_HITS);
+            return *hit;
+        }
+        Stats::count(Stats::RESOLVE_CACHE_MISSES);
+        return cache->resolved.get_or_compute(key, [&]
+        {
+            Stats::Scope scope(Stats::RESOLVE, name);
+            return resolve_library(name, ex.rpaths, ex.runpaths, inherited, ex.arch);
+        });
+    }
+
+    // Sets up per-root search state (LD_LIBRARY_PATH with this root's $ORIGIN).
+    void prepare(const std::string& root_path)
+    {
+        ld_paths.clear();
+        if (const char* env_p = std::getenv("LD_LIBRARY_PATH"))
+        {
+            std::string origin = fs::path(root_path).parent_path().string();
+            for (auto p : split_path(env_p))
+            {
+                p = Sysroot::host(p);
+                size_t pos = 0;
+                while ((pos = p.find("$ORIGIN", pos)) != std::string::npos)
+                {
+                    p.replace(pos, 7, origin);
+                    pos += origin.length();
+                }
+                ld_paths.push_back(absolute_dir(p));
+            }
+        }
+        root_name = fs::path(root_path).filename().string();
+    }
+
+    // Parses and resolves everything reachable from `path` on the pool. This only warms the
+    // shared cache; the graph itself is still assembled by walk(), so depth and parents
+    // ordering match a --jobs 1 run exactly. The graph must outlive pool.wait().
+    void prefetch(WorkStealingPool& pool, const std::string& path, const std::vector<std::string>& inherited,
+                  bool show_stdlib)
+    {
+        if (!cache->visited.insert(context_key(path, {&inherited, &ld_paths}), true)) return;
+        try
+        {
+            auto dyn = load_dynamic(path);
+            if (!dyn) return;
+
+            auto ex = expand(path, *dyn, inherited, show_stdlib);
+            for (const auto& lib : ex.children)
+            {
+                if (auto res = resolve_cached(lib, ex, inherited))
+                {
+                    pool.submit([this, &pool, p = *res, next = ex.next_inherited, show_stdlib]
+                    {
+                        prefetch(pool, p, next, show_stdlib);
+                    });
+                }
+            }
+        }
+        catch (const std::exception&)
+        {
+            // Best effort: walk() redoes this object and reports the failure.
+        }
+    }
+
+    // Nodes are keyed by the file a DT_NEEDED entry resolves to from its parent, so one SONAME
+    // resolved to different files through different RPATHs gives separate nodes, and links to one
+    // file reached by different names give one. Unresolved names are keyed by name.
+    void walk(const std::string& root_path, bool show_stdlib)
+    {
+        std::unordered_map<FileId, NodeId, FileIdHash> by_file;
+        std::unordered_map<std::string, NodeId> by_name;
+        auto node_for = [&](const std::string& label, const std::optional<std::string>& path) -> NodeId
+        {
+            const auto next = static_cast<NodeId>(nodes.size());
+            const auto file = path ? cache->identity(*path) : std::nullopt;
+            const NodeId id = file ? by_file.try_emplace(*file, next).first->second
+                                   : by_name.try_emplace(path.value_or(label), next).first->second;
+            if (id == next)
+            {
+                names.push_back(label);
+                labels.try_emplace(label, id);
+                nodes.push_back({path.value_or(""), "", -1});
+            }
+            else if (names[id] != label) aliases.try_emplace(label, id);
+            return id;
+        };
+
+        root = node_for(root_name, root_path);
+        nodes[root].depth = 0;
+
+        struct WorkItem
+        {
+            NodeId id;
+            std::vector<std::string> inherited_rpaths;
+        };
+
+        std::vector<std::pair<NodeId, NodeId>> child_edges;
+        std::vector<std::pair<NodeId, NodeId>> parent_edges;
+        std::vector<WorkItem> stack;
+        stack.push_back({root, {}});
+
+        while (!stack.empty())
+        {
+            auto [cur, inherited] = stack.back();
+            stack.pop_back();
+
+            std::string cur_path = nodes[cur].path;
+            if (cur_path.empty()) continue;
+
+            auto dyn = load_dynamic(cur_path);
+            if (!dyn) continue;
+
+            auto ex = expand(cur_path, *dyn, inherited, show_stdlib);
+
+            std::vector<NodeId> kids;
+            for (const auto& lib : ex.children)
+            {
+                const NodeId id = node_for(lib, resolve_cached(lib, ex, inherited));
+                if (r::find(kids, id) != kids.end()) continue;
+                kids.push_back(id);
+                child_edges.emplace_back(cur, id);
+            }
+
+            // Each object is expanded once and its children are unique, so every
+            // (child, cur) parent edge is recorded at most once.
+            for (const auto id : v::reverse(kids))
+            {
+                parent_edges.emplace_back(id, cur);
+                if (nodes[id].depth != -1) continue;
+
+                nodes[id].depth = nodes[cur].depth + 1;
+                if (!nodes[id].path.empty()) stack.push_back({id, ex.next_inherited});
+            }
+        }
+
+        children = Adjacency::from_edges(nodes.size(), child_edges);
+        parents = Adjacency::from_edges(nodes.size(), parent_edges);
+
+        std::unordered_map<std::string_view, uint32_t> uses;
+        for (const auto& n : names) ++uses[n];
+        ambiguous.resize(nodes.size());
+        for (NodeId id = 0; id < nodes.size(); ++id) ambiguous[id] = uses[names[id]] > 1;
+    }
+
+    const std::string& name(NodeId id) const { return names[id]; }
+
+    std::optional<NodeId> find(std::string_view name) const
+    {
+        const std::string key(name);
+        if (const auto it = labels.find(key); it != labels.end()) return it->second;
+        if (const auto it = aliases.find(key); it != aliases.end()) return it->second;
+        return std::nullopt;
+    }
+
+    // Names shared by several files fall back to the path, so every node prints distinctly.
+    const std::string& display(NodeId id, bool full_path) const
+    {
+        return ((full_path || ambiguous[id]) && !nodes[id].path.empty()) ? nodes[id].path : names[id];
+    }
+
+    // The order ld.so maps objects in, which is also the global symbol lookup scope:
+    // breadth-first from the root, DT_NEEDED order within an object. build() walks depth-first,
+    // so node ids don't follow it.
+    std::vector<NodeId> load_order() const
+    {
+        std::vector<NodeId> order{root};
+        std::vector<char> queued(nodes.size(), 0);
+        queued[root] = 1;
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            for (const auto child : children[order[i]])
+            {
+                if (!queued[child])
+                {
+                    queued[child] = 1;
+                    order.push_back(child);
+                }
+            }
+        }
+        return order;
+    }
+
+    // Symbol tables indexed by node, and the objects that have one in load order.
+    struct SymbolScope
+    {
+        std::vector<std::shared_ptr<const SymbolTable>> tables;
+        std::vector<NodeId> order;
+    };
+
+    SymbolScope symbol_scope() const
+    {
+        SymbolScope out;
+        out.tables.resize(nodes.size());
+        for (const auto id : load_order())
+        {
+            if (nodes[id].path.empty()) continue;
+            out.tables[id] = cache->symbol_table(nodes[id].path);
+            if (out.tables[id]) out.order.push_back(id);
+        }
+        return out;
+    }
+
+    std::vector<std::string> resolved_paths() const
+    {
+        std::vector<std::string> all_paths;
+        for (const auto& n : nodes)
+        {
+            if (!n.path.empty()) all_paths.push_back(n.path);
+        }
+        return all_paths;
+    }
+
+    // Copies package names from the (already batch-resolved) ALPM cache onto the nodes.
+    void assign_packages()
+    {
+        for (auto& n : nodes)
+        {
+            if (!n.path.empty()) n.pkg = cache->alpm.get_package(n.path);
+        }
+    }
+
+    void build(const std::string& root_path, bool show_stdlib, bool resolve_packages = true, size_t jobs = 1)
+    {
+        prepare(root_path);
+
+        if (jobs > 1)
+        {
+            Stats::Scope scope(Stats::PREFETCH);
+            WorkStealingPool pool(jobs);
+            pool.submit([&] { prefetch(pool, root_path, {}, show_stdlib); });
+            pool.wait();
+        }
+
+        {
+            Stats::Scope scope(Stats::WALK);
+            walk(root_path, show_stdlib);
+        }
+
+        if (resolve_packages)
+        {
+            cache->alpm.batch_resolve(resolved_paths());
+            assign_packages();
+        }
+    }
+
+    std::vector<std::string> get_minimal_pkgs() const
+    {
+        const std::string& root_pkg_name = nodes[root].pkg;
+        bool has_root_pkg = !root_pkg_name.empty() && root_pkg_name != "-";
+
+        auto pkg_of = [&](NodeId id) -> std::optional<std::string_view>
+        {
+            const auto& pkg = nodes[id].pkg;
+            if (pkg.empty() || pkg == "-") return std::nullopt;
+            if (has_root_pkg && pkg == root_pkg_name) return "__ROOT__";
+            return pkg;
+        };
+
+        std::unordered_map<std::string_view, std::unordered_set<std::string_view>> pkg_deps;
+
+        for (NodeId parent = 0; parent < nodes.size(); ++parent)
+        {
+            auto p_pkg = parent == root ? std::optional<std::string_view>("__ROOT__") : pkg_of(parent);
+            if (!p_pkg) continue;
+
+            for (const auto child : children[parent])
+            {
+                if (auto c_pkg = pkg_of(child); c_pkg && *c_pkg != *p_pkg) pkg_deps[*p_pkg].insert(*c_pkg);
+            }
+        }
+
+        std::unordered_set<std::string_view> transitive;
+        for (const auto& [p, kids] : pkg_deps)
+        {
+            if (p != "__ROOT__") transitive.insert(kids.begin(), kids.end());
+        }
+
+        std::vector<std::string> result;
+        if (const auto it = pkg_deps.find("__ROOT__"); it != pkg_deps.end())
+        {
+            for (const auto& p : it->second)
+            {
+                if (!transitive.contains(p)) result.emplace_back(p);
+            }
+        }
+        r::sort(result);
+        return result;
+    }
+};
+
+bool is_elf_file(const fs::path& p)
+{
+    std::ifstream f(p, std::ios::binary);
+    char magic[4]{};
+    return f.read(magic, sizeof(magic)) && std::string_view(magic, 4) == "\x7f" "ELF";
+}
+
+// --rdeps: DT_NEEDED edges of every ELF file below a set of directories, stored reversed next
+// to the dynamic cache. A query compares the mtime of each indexed directory and walks the mapped
+// arrays. Installs and package upgrades add, remove or rename entries, which changes that mtime;
+// a file rewritten in place is noticed once its directory changes. Only directories whose mtime
+// moved are listed again, and only their new or modified files are parsed. Edges are each
+// object's own resolution (its RPATH/RUNPATH, ld.so.cache, default paths), without
+// LD_LIBRARY_PATH or an executable's inherited RPATH. Lookups binary-search a sorted table of
+// every path, SONAME and file name. Layout, native byte order:
+//   Header | Dir[dir_count] | File[file_count] | uint32_t needed[] | uint32_t users[] | Name[] | char strings[]
+class ReverseIndex
+{
+    struct Header
+    {
+        char magic[8];
+        uint32_t byte_order;
+        uint32_t dir_count;
+        uint32_t file_count;
+        uint32_t roots;
+        int64_t ld_cache_sec;
+        int64_t ld_cache_nsec;
+        uint64_t needed_offset;
+        uint64_t needed_count;
+        uint64_t users_offset;
+        uint64_t users_count;
+        uint64_t names_offset;
+        uint64_t names_count;
+        uint64_t strings_offset;
+        uint64_t strings_size;
+    };
+
+    // parent is the directory this one was listed from, NO_DIR for a root.
+    struct Dir
+    {
+        uint32_t path;
+        uint32_t parent;
+        int64_t mtime_sec;
+        int64_t mtime_nsec;
+    };
+
+    // users lists the files whose DT_NEEDED entries resolve to this one.
+    struct File
+    {
+        uint32_t path;
+        uint32_t soname;
+        uint32_t rpath;
+        uint32_t runpath;
+        uint64_t dev;
+        uint64_t ino;
+        int64_t mtime_sec;
+        int64_t mtime_nsec;
+        uint64_t size;
+        uint32_t needed_first;
+        uint32_t needed_count;
+        uint32_t users_first;
+        uint32_t users_count;
+        uint32_t e_flags;
+        uint16_t e_machine;
+        uint8_t elf_class;
+        // Reached through a resolution from outside the scanned directories.
+        uint8_t extra;
+        // The directory it was listed in, NO_DIR for extra files.
+        uint32_t dir;
+    };
+
+    // A path, SONAME or file name of a file; sorted by name.
+    struct Name
+    {
+        uint32_t name;
+        uint32_t file;
+    };
+
+    // A file while the index is rebuilt.
+    struct Record
+    {
+        std::string path;
+        struct stat st;
+        DynamicInfo info;
+        bool extra = false;
+        uint32_t dir = NO_DIR;
+    };
+
+    static constexpr std::string_view MAGIC{"IDRDEP2\0", 8};
+    static constexpr uint32_t NO_DIR = UINT32_MAX;
+    static constexpr uint32_t ENDIAN_TAG = 0x01020304;
+    static constexpr const char* LD_CACHE_PATH = "/etc/ld.so.cache";
+
+    std::optional<std::string> index_path;
+    void* mmap_addr = MAP_FAILED;
+    size_t mmap_size = 0;
+    std::string owned;
+    const Header* header = nullptr;
+    std::span<const Dir> dirs;
+    std::span<const File> files;
+    std::span<const uint32_t> needed;
+    std::span<const uint32_t> users;
+    std::span<const Name> names;
+    std::string_view strings;
+
+    std::string_view str(uint32_t off) const
+    {
+        if (off >= strings.size()) return {};
+        return strings.substr(off, strings.find('\0', off) - off);
+    }
+
+    bool attach(const char* base, size_t size)
+    {
+        header = nullptr;
+        if (size < sizeof(Header)) return false;
+        const auto* h = reinterpret_cast<const Header*>(base);
+        if (std::string_view(h->magic, 8) != MAGIC || h->byte_order != ENDIAN_TAG) return false;
+
+        const uint64_t dirs_end = sizeof(Header) + static_cast<uint64_t>(h->dir_count) * sizeof(Dir);
+        const uint64_t files_end = dirs_end + static_cast<uint64_t>(h->file_count) * sizeof(File);
+        if (files_end > size || h->needed_offset < files_end || h->needed_offset % alignof(uint32_t) != 0 ||
+            h->needed_count > (size - h->needed_offset) / sizeof(uint32_t) ||
+            h->users_offset < h->needed_offset + h->needed_count * sizeof(uint32_t) ||
+            h->users_offset % alignof(uint32_t) != 0 ||
+            h->users_count > (size - h->users_offset) / sizeof(uint32_t) ||
+            h->names_offset < h->users_offset + h->users_count * sizeof(uint32_t) ||
+            h->names_offset % alignof(Name) != 0 || h->names_count > (size - h->names_offset) / sizeof(Name) ||
+            h->strings_offset > size ||
+            h->strings_size == 0 || h->strings_size > size - h->strings_offset ||
+            base[h->strings_offset + h->strings_size - 1] != '\0')
+            return false;
+
+        const auto dir_span = std::span(reinterpret_cast<const Dir*>(base + sizeof(Header)), h->dir_count);
+        if (r::any_of(dir_span, [&](const Dir& d) { return d.parent != NO_DIR && d.parent >= h->dir_count; }))
+            return false;
+        const auto file_span = std::span(reinterpret_cast<const File*>(base + dirs_end), h->file_count);
+        for (const auto& f : file_span)
+        {
+            if (f.needed_first > h->needed_count || f.needed_count > h->needed_count - f.needed_first ||
+                f.users_first > h->users_count || f.users_count > h->users_count - f.users_first ||
+                (f.dir != NO_DIR && f.dir >= h->dir_count))
+                return false;
+        }
+        const auto user_span = std::span(reinterpret_cast<const uint32_t*>(base + h->users_offset), h->users_count);
+        if (r::any_of(user_span, [&](uint32_t u) { return u >= h->file_count; })) return false;
+        const auto name_span = std::span(reinterpret_cast<const Name*>(base + h->names_offset), h->names_count);
+        if (r::any_of(name_span, [&](const Name& n) { return n.file >= h->file_count; })) return false;
+
+        header = h;
+        dirs = dir_span;
+        files = file_span;
+        needed = std::span(reinterpret_cast<const uint32_t*>(base + h->needed_offset), h->needed_count);
+        users = user_span;
+        names = name_span;
+        strings = std::string_view(base + h->strings_offset, h->strings_size);
+        return true;
+    }
+
+    static timespec ld_cache_mtime()
+    {
+        struct stat st{};
+        Stats::count(Stats::STAT_CALLS);
+        if (::stat(LD_CACHE_PATH, &st) != 0) return {};
+        return st.st_mtim;
+    }
+
+    static bool same_file(const struct stat& st, const File& f)
+    {
+        return static_cast<uint64_t>(st.st_dev) == f.dev && static_cast<uint64_t>(st.st_ino) == f.ino &&
+               st.st_mtim.tv_sec == f.mtime_sec && st.st_mtim.tv_nsec == f.mtime_nsec &&
+               static_cast<uint64_t>(st.st_size) == f.size;
+    }
+
+    // The identity recorded for f, for files kept without a stat.
+    static struct stat stored_stat(const File& f)
+    {
+        struct stat st{};
+        st.st_dev = static_cast<dev_t>(f.dev);
+        st.st_ino = static_cast<ino_t>(f.ino);
+        st.st_mtim = {static_cast<time_t>(f.mtime_sec), static_cast<long>(f.mtime_nsec)};
+        st.st_size = static_cast<off_t>(f.size);
+        return st;
+    }
+
+    Record decode(const File& f, const struct stat& st) const
+    {
+        Record rec{std::string(str(f.path)), st, {}, f.extra != 0};
+        rec.info.arch = {f.elf_class, f.e_machine, f.e_flags};
+        for (const auto off : needed.subspan(f.needed_first, f.needed_count)) rec.info.needed.emplace_back(str(off));
+        rec.info.soname = str(f.soname);
+        rec.info.rpath = str(f.rpath);
+        rec.info.runpath = str(f.runpath);
+        return rec;
+    }
+
+    struct DirRecord
+    {
+        std::string path;
+        uint32_t parent;
+        timespec mtime;
+    };
+
+    void store(const std::string& roots, const std::vector<DirRecord>& dir_list, const std::vector<Record>& records,
+               const Adjacency& users_of)
+    {
+        std::string string_table(1, '\0');
+        std::unordered_map<std::string, uint32_t> string_index{{"", 0}};
+        auto intern = [&](const std::string& s)
+        {
+            auto [it, inserted] = string_index.try_emplace(s, static_cast<uint32_t>(string_table.size()));
+            if (inserted)
+            {
+                string_table += s;
+                string_table += '\0';
+            }
+            return it->second;
+        };
+
+        std::vector<Dir> out_dirs;
+        for (const auto& d : dir_list) out_dirs.push_back({intern(d.path), d.parent, d.mtime.tv_sec, d.mtime.tv_nsec});
+
+        std::vector<File> out_files;
+        std::vector<uint32_t> out_needed;
+        for (uint32_t i = 0; i < records.size(); ++i)
+        {
+            const auto& rec = records[i];
+            File f{};
+            f.path = intern(rec.path);
+            f.soname = intern(rec.info.soname);
+            f.rpath = intern(rec.info.rpath);
+            f.runpath = intern(rec.info.runpath);
+            f.dev = rec.st.st_dev;
+            f.ino = rec.st.st_ino;
+            f.mtime_sec = rec.st.st_mtim.tv_sec;
+            f.mtime_nsec = rec.st.st_mtim.tv_nsec;
+            f.size = rec.st.st_size;
+            f.needed_first = static_cast<uint32_t>(out_needed.size());
+            for (const auto& n : rec.info.needed) out_needed.push_back(intern(n));
+            f.needed_count = static_cast<uint32_t>(rec.info.needed.size());
+            f.users_first = users_of.offsets[i];
+            f.users_count = users_of.offsets[i + 1] - users_of.offsets[i];
+            f.e_flags = rec.info.arch.flags;
+            f.e_machine = rec.info.arch.machine;
+            f.elf_class = rec.info.arch.elf_class;
+            f.extra = rec.extra;
+            f.dir = rec.dir;
+            out_files.push_back(f);
+        }
+
+        // Every file under its path, its file name and a differing SONAME.
+        std::vector<std::pair<std::string_view, uint32_t>> keys;
+        for (uint32_t i = 0; i < records.size(); ++i)
+        {
+            const std::string_view path = records[i].path;
+            const auto base = path.substr(path.rfind('/') + 1);
+            keys.emplace_back(path, i);
+            keys.emplace_back(base, i);
+            if (const std::string_view soname = records[i].info.soname; !soname.empty() && soname != base)
+                keys.emplace_back(soname, i);
+        }
+        r::sort(keys);
+        std::vector<Name> out_names;
+        for (const auto& [name, file] : keys) out_names.push_back({intern(std::string(name)), file});
+
+        Header h{};
+        std::memcpy(h.magic, MAGIC.data(), MAGIC.size());
+        h.byte_order = ENDIAN_TAG;
+        h.dir_count = static_cast<uint32_t>(out_dirs.size());
+        h.file_count = static_cast<uint32_t>(out_files.size());
+        h.roots = intern(roots);
+        const auto ld_mtime = ld_cache_mtime();
+        h.ld_cache_sec = ld_mtime.tv_sec;
+        h.ld_cache_nsec = ld_mtime.tv_nsec;
+        h.needed_offset = sizeof(Header) + out_dirs.size() * sizeof(Dir) + out_files.size() * sizeof(File);
+        h.needed_count = out_needed.size();
+        h.users_offset = h.needed_offset + out_needed.size() * sizeof(uint32_t);
+        h.users_count = users_of.ids.size();
+        h.names_offset = h.users_offset + users_of.ids.size() * sizeof(uint32_t);
+        h.names_count = out_names.size();
+        h.strings_offset = h.names_offset + out_names.size() * sizeof(Name);
+        h.strings_size = string_table.size();
+
+        std::string blob;
+        blob.append(reinterpret_cast<const char*>(&h), sizeof(h));
+        blob.append(reinterpret_cast<const char*>(out_dirs.data()), out_dirs.size() * sizeof(Dir));
+        blob.append(reinterpret_cast<const char*>(out_files.data()), out_files.size() * sizeof(File));
+        blob.append(reinterpret_cast<const char*>(out_needed.data()), out_needed.size() * sizeof(uint32_t));
+        blob.append(reinterpret_cast<const char*>(users_of.ids.data()), users_of.ids.size() * sizeof(uint32_t));
+        blob.append(reinterpret_cast<const char*>(out_names.data()), out_names.size() * sizeof(Name));
+        blob.append(string_table);
+
+        if (index_path)
+        {
+            std::error_code ec;
+            fs::create_directories(fs::path(*index_path).parent_path(), ec);
+            const std::string tmp = std::format("{}.{}.tmp", *index_path, getpid());
+            {
+                std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+                f.write(blob.data(), static_cast<std::streamsize>(blob.size()));
+                if (!f) fs::remove(tmp, ec);
+            }
+            if (fs::exists(tmp, ec))
+            {
+                fs::rename(tmp, *index_path, ec);
+                if (ec) fs::remove(tmp, ec);
+            }
+        }
+
+        // The old mapping is only read while rebuilding; from here on the index answers from memory.
+        if (mmap_addr != MAP_FAILED) munmap(mmap_addr, mmap_size);
+        mmap_addr = MAP_FAILED;
+        owned = std::move(blob);
+        attach(owned.data(), owned.size());
+    }
+
+public:
+    explicit ReverseIndex(std::optional<std::string> path) : index_path(std::move(path))
+    {
+        if (!index_path) return;
+        const int fd = ::open(index_path->c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) return;
+
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header))
+        {
+            mmap_size = st.st_size;
+            mmap_addr = mmap(nullptr, mmap_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            Stats::count(Stats::BYTES_MAPPED, mmap_size);
+        }
+        close(fd);
+
+        if (mmap_addr != MAP_FAILED) attach(static_cast<const char*>(mmap_addr), mmap_size);
+    }
+
+    ReverseIndex(const ReverseIndex&) = delete;
+    ReverseIndex& operator=(const ReverseIndex&) = delete;
+
+    ~ReverseIndex()
+    {
+        if (mmap_addr != MAP_FAILED) munmap(mmap_addr, mmap_size);
+    }
+
+    static std::optional<std::string> default_path()
+    {
+        auto cache = DynamicCache::default_path();
+        if (!cache) return std::nullopt;
+        return (fs::path(*cache).parent_path() / "rdeps.index").string();
+    }
+
+    // Whether the index covers `roots` ('\n'-separated) and none of its directories changed.
+    bool fresh(const std::string& roots) const
+    {
+        if (!header || str(header->roots) != roots) return false;
+        const auto ld_mtime = ld_cache_mtime();
+        if (ld_mtime.tv_sec != header->ld_cache_sec || ld_mtime.tv_nsec != header->ld_cache_nsec) return false;
+
+        struct stat st{};
+        for (const auto& d : dirs)
+        {
+            Stats::count(Stats::STAT_CALLS);
+            if (::stat(std::string(str(d.path)).c_str(), &st) != 0 || st.st_mtim.tv_sec != d.mtime_sec ||
+                st.st_mtim.tv_nsec != d.mtime_nsec)
+                return false;
+        }
+        return true;
+    }
+
+    // Walks `roots` again. Directories with their recorded mtime keep their files and
+    // subdirectories as stored; the others are listed, their unchanged files keep their records
+    // and the rest are parsed. Every edge is then resolved from scratch and the result persisted.
+    void rebuild(const std::vector<std::string>& roots, const std::string& roots_key, DepGraph& resolver, size_t jobs)
+    {
+        Stats::Scope scope(Stats::RDEPS_INDEX);
+        std::unordered_map<std::string_view, const File*> previous;
+        for (const auto& f : files) previous.emplace(str(f.path), &f);
+        std::unordered_map<std::string_view, uint32_t> previous_dirs;
+        std::vector<std::vector<uint32_t>> subdirs_of(dirs.size());
+        std::vector<std::vector<uint32_t>> files_of(dirs.size());
+        for (uint32_t i = 0; i < dirs.size(); ++i)
+        {
+            previous_dirs.emplace(str(dirs[i].path), i);
+            if (dirs[i].parent != NO_DIR) subdirs_of[dirs[i].parent].push_back(i);
+        }
+        for (uint32_t i = 0; i < files.size(); ++i)
+        {
+            if (files[i].dir != NO_DIR) files_of[files[i].dir].push_back(i);
+        }
+
+        std::vector<DirRecord> dir_list;
+        std::vector<Record> records;
+        std::vector<std::tuple<std::string, struct stat, uint32_t>> changed;
+        std::unordered_set<std::string> listed;
+        std::vector<std::pair<std::string, uint32_t>> stack;
+        for (const auto& root : roots | std::views::reverse) stack.emplace_back(root, NO_DIR);
+        while (!stack.empty())
+        {
+            const auto [dir, parent] = std::move(stack.back());
+            stack.pop_back();
+            struct stat st{};
+            Stats::count(Stats::STAT_CALLS);
+            if (!listed.insert(dir).second || ::stat(dir.c_str(), &st) != 0) continue;
+            const auto index = static_cast<uint32_t>(dir_list.size());
+            std::vector<std::string> subdirs;
+
+            if (const auto old = previous_dirs.find(dir); old != previous_dirs.end() &&
+                dirs[old->second].mtime_sec == st.st_mtim.tv_sec && dirs[old->second].mtime_nsec == st.st_mtim.tv_nsec)
+            {
+                dir_list.push_back({dir, parent, st.st_mtim});
+                for (const auto f : files_of[old->second])
+                {
+                    records.push_back(decode(files[f], stored_stat(files[f])));
+                    records.back().dir = index;
+                }
+                for (const auto sub : subdirs_of[old->second]) subdirs.emplace_back(str(dirs[sub].path));
+                r::sort(subdirs, r::greater{});
+                for (auto& sub : subdirs) stack.emplace_back(std::move(sub), index);
+                continue;
+            }
+
+            DIR* d = opendir(dir.c_str());
+            if (!d) continue;
+            Stats::count(Stats::DIRS_LISTED);
+            dir_list.push_back({dir, parent, st.st_mtim});
+
+            while (const dirent* e = readdir(d))
+            {
+                const std::string_view name = e->d_name;
+                if (name == "." || name == "..") continue;
+                auto path = (fs::path(dir) / name).string();
+                unsigned char type = e->d_type;
+                Stats::count(Stats::STAT_CALLS);
+                if (type == DT_UNKNOWN && lstat(path.c_str(), &st) == 0)
+                    type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+                if (type == DT_DIR) subdirs.push_back(std::move(path));
+                if (type != DT_REG || ::stat(path.c_str(), &st) != 0) continue;
+
+                if (const auto it = previous.find(path); it != previous.end() && same_file(st, *it->second))
+                {
+                    records.push_back(decode(*it->second, st));
+                    records.back().dir = index;
+                }
+                else if (is_elf_file(path))
+                {
+                    changed.emplace_back(std::move(path), st, index);
+                }
+            }
+            closedir(d);
+            r::sort(subdirs, r::greater{});
+            for (auto& sub : subdirs) stack.emplace_back(std::move(sub), index);
+        }
+
+        if (jobs > 1)
+        {
+            WorkStealingPool pool(jobs);
+            for (const auto& entry : changed)
+            {
+                pool.submit([&resolver, &path = std::get<0>(entry)] { resolver.load_dynamic(path); });
+            }
+            pool.wait();
+        }
+        for (auto& [path, st, dir] : changed)
+        {
+            if (auto info = resolver.load_dynamic(path))
+                records.push_back({std::move(path), st, std::move(*info), false, dir});
+        }
+
+        // Resolved paths usually name a symlink (libz.so.1), so they are matched by file identity.
+        std::map<std::pair<dev_t, ino_t>, uint32_t> by_identity;
+        for (uint32_t i = 0; i < records.size(); ++i)
+        {
+            by_identity.emplace(std::pair(records[i].st.st_dev, records[i].st.st_ino), i);
+        }
+        std::unordered_map<std::string, std::optional<uint32_t>> by_path;
+
+        // Libraries resolved outside the scanned directories (a private RUNPATH, say) are
+        // indexed as well, so what they load is followed too. The list grows while walked.
+        std::vector<std::pair<NodeId, NodeId>> edges;
+        for (uint32_t i = 0; i < records.size(); ++i)
+        {
+            const auto ex = DepGraph::expand(records[i].path, records[i].info, {}, true);
+            for (const auto& lib : ex.children)
+            {
+                const auto path = resolver.resolve_cached(lib, ex, {});
+                if (!path) continue;
+                auto [it, inserted] = by_path.try_emplace(*path);
+                if (inserted)
+                {
+                    struct stat st{};
+                    Stats::count(Stats::STAT_CALLS);
+                    if (::stat(path->c_str(), &st) != 0) continue;
+                    if (const auto known = by_identity.find(std::pair(st.st_dev, st.st_ino)); known != by_identity.end())
+                    {
+                        it->second = known->second;
+                    }
+                    else
+                    {
+                        std::error_code ec;
+                        auto canonical = fs::canonical(*path, ec).string();
+                        if (ec) continue;
+                        if (const auto old = previous.find(canonical); old != previous.end() && same_file(st, *old->second))
+                            records.push_back(decode(*old->second, st));
+                        else if (auto info = resolver.load_dynamic(canonical))
+                            records.push_back({std::move(canonical), st, std::move(*info)});
+                        else
+                            continue;
+                        records.back().extra = true;
+                        it->second = static_cast<uint32_t>(records.size() - 1);
+                        by_identity.emplace(std::pair(st.st_dev, st.st_ino), *it->second);
+                    }
+                }
+                if (it->second && *it->second != i) edges.emplace_back(*it->second, i);
+            }
+        }
+        r::sort(edges);
+        edges.erase(r::unique(edges).begin(), edges.end());
+
+        store(roots_key, dir_list, records, Adjacency::from_edges(records.size(), edges));
+    }
+
+    size_t size() const { return files.size(); }
+    std::string_view path(uint32_t i) const { return str(files[i].path); }
+
+    // SONAME, or the file name for objects without one.
+    std::string_view name(uint32_t i) const
+    {
+        if (const auto soname = str(files[i].soname); !soname.empty()) return soname;
+        const auto p = path(i);
+        return p.substr(p.rfind('/') + 1);
+    }
+
+    std::span<const uint32_t> users_of(uint32_t i) const
+    {
+        return users.subspan(files[i].users_first, files[i].users_count);
+    }
+
+    // Files `lib` names: a canonical path, or a SONAME or file name.
+    std::vector<uint32_t> find(std::string_view lib) const
+    {
+        std::vector<uint32_t> out;
+        for (const auto& n : r::equal_range(names, lib, {}, [&](const Name& e) { return str(e.name); }))
+        {
+            if (!lib.contains('/') || path(n.file) == lib) out.push_back(n.file);
+        }
+        return out;
+    }
+};
+
+// Buffered stdout for the output modes. Lines are formatted straight into one block, which goes
+// out with a single fwrite whenever it passes BLOCK bytes and when the writer is destroyed, so
+// long outputs cost a few large writes instead of a stdio call per fragment.
+class OutputWriter
+{
+    static constexpr size_t BLOCK = 64 * 1024;
+
+    std::string buf;
+
+public:
+    OutputWriter() { buf.reserve(BLOCK + BLOCK / 4); }
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    ~OutputWriter() { flush(); }
+
+    template <typename... Args>
+    void print(std::format_string<Args...> fmt, Args&&... args)
+    {
+        std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
+        if (buf.size() >= BLOCK) flush();
+    }
+
+    template <typename... Args>
+    void println(std::format_string<Args...> fmt, Args&&... args)
+    {
+        std::format_to(std::back_inserter(buf), fmt, std::forward<Args>(args)...);
+        buf += '\n';
+        if (buf.size() >= BLOCK) flush();
+    }
+
+    void write(std::string_view s)
+    {
+        buf += s;
+        if (buf.size() >= BLOCK) flush();
+    }
+
+    // Also call before writing to std::cerr, so messages land after the output that preceded them.
+    void flush()
+    {
+        if (buf.empty()) return;
+        std::fwrite(buf.data(), 1, buf.size(), stdout);
+        std::fflush(stdout);
+        buf.clear();
+    }
+};
+
+struct JsonOutput
+{
+    std::string root;
+    std::map<std::string, std::map<std::string, std::string>> dependencies;
+    std::vector<std::string> minimal_packages;
+};
+
+// --ndjson records. Fields view the graph's own strings, so nothing is copied to serialize one.
+struct NdjsonNode
+{
+    std::string_view type = "node";
+    std::string_view binary;
+    std::string_view name;
+    std::string_view path;
+    std::string_view pkg;
+    int depth = 0;
+    std::vector<std::string_view> parents;
+    std::vector<std::string_view> children;
+};
+
+struct NdjsonBinary
+{
+    std::string_view type = "binary";
+    std::string_view binary;
+    size_t libraries = 0;
+    size_t missing = 0;
+    std::vector<std::string> minimal_packages;
+};
+
+struct NdjsonEdge
+{
+    std::string_view from;
+    std::string_view to;
+};
+
+struct NdjsonDiff
+{
+    std::string_view type = "diff";
+    std::string_view binary;
+    std::vector<NdjsonEdge> added_edges;
+    std::vector<NdjsonEdge> removed_edges;
+    std::vector<std::string_view> added_packages;
+    std::vector<std::string_view> removed_packages;
+};
+
+void print_tree(OutputWriter& out, const DepGraph& g, const NodeId root, const bool show_pkgs, const bool use_color,
+                bool full_path)
+{
+    std::string gray = use_color ? "\033[90m" : "";
+    std::string reset = use_color ? "\033[0m" : "";
+
+    // Children sorted by name once, in place in a copy of the CSR arrays.
+    Adjacency sorted = g.children;
+    for (size_t n = 0; n + 1 < sorted.offsets.size(); ++n)
+    {
+        r::sort(r::subrange(sorted.ids.begin() + sorted.offsets[n], sorted.ids.begin() + sorted.offsets[n + 1]), {},
+                [&](NodeId c) -> const std::string& { return g.name(c); });
+    }
+
+    std::vector<char> seen(g.nodes.size(), 0);
+    std::vector<char> path(g.nodes.size(), 0);
+    // One prefix string grows and shrinks with the recursion.
+    std::string pref;
+    auto rec = [&](auto&& self, const NodeId n, const bool last) -> void
+    {
+        const auto& node = g.nodes[n];
+        out.print("{}{} {}", pref, (last ? "└── " : "├── "), g.display(n, full_path));
+
+        if (show_pkgs)
+        {
+            out.print(" {}[{}]", gray, (node.pkg.empty() ? "-" : node.pkg));
+            if (use_color) out.write(reset);
+        }
+
+        if (path[n])
+        {
+            out.println(" (cycle)");
+            return;
+        }
+
+        if (seen[n])
+        {
+            out.println(" (+)");
+            return;
+        }
+        out.write("\n");
+
+        seen[n] = 1;
+        path[n] = 1;
+
+        const size_t len = pref.size();
+        pref += last ? "    " : "│   ";
+        const auto kids = sorted[n];
+        for (size_t i = 0; i < kids.size(); ++i) self(self, kids[i], i == kids.size() - 1);
+        pref.resize(len);
+        path[n] = 0;
+    };
+
+    const auto& root_node = g.nodes[root];
+    out.write(g.display(root, full_path));
+    if (show_pkgs)
+    {
+        out.print(" {}[{}]", gray, (root_node.pkg.empty() ? "-" : root_node.pkg));
+        if (use_color) out.write(reset);
+    }
+    out.write("\n");
+
+    path[root] = 1;
+    seen[root] = 1;
+
+    const auto kids = sorted[root];
+    for (size_t i = 0; i < kids.size(); ++i) rec(rec, kids[i], i == kids.size() - 1);
+}
+
+// Maps a --why argument (SONAME, resolved path, any path to the same file, or file name) to a node.
+std::optional<NodeId> find_target(const DepGraph& g, const std::string& target_in)
+{
+    if (auto id = g.find(target_in)) return id;
+
+    // 1. Try matching full path
+    for (NodeId id = 0; id < g.nodes.size(); ++id)
+    {
+        if (g.nodes[id].path == target_in) return id;
+    }
+
+    // 2. Try matching the file itself (symlinks, hard links)
+    if (auto file = g.cache->identity(target_in))
+    {
+        for (NodeId id = 0; id < g.nodes.size(); ++id)
+        {
+            if (!g.nodes[id].path.empty() && g.cache->identity(g.nodes[id].path) == file) return id;
+        }
+    }
+
+    // 3. Try matching filename
+    return g.find(fs::path(target_in).filename().string());
+}
+
+// Shortest root..`to` chain through `children` by BFS, never entering `blocked` nodes and not
+// taking the edges `from` -> `skip`. Ties go to the earlier DT_NEEDED entry.
+std::optional<std::vector<NodeId>> shortest_chain(const DepGraph& g, const NodeId from, const NodeId to,
+                                                  const std::vector<char>& blocked, std::span<const NodeId> skip)
+{
+    std::vector<NodeId> prev(g.nodes.size(), from);
+    std::vector<char> seen(g.nodes.size(), 0);
+    std::deque<NodeId> queue{from};
+    seen[from] = 1;
+
+    while (!queue.empty() && !seen[to])
+    {
+        const NodeId cur = queue.front();
+        queue.pop_front();
+        for (const auto child : g.children[cur])
+        {
+            if (seen[child] || blocked[child]) continue;
+            if (cur == from && r::find(skip, child) != skip.end()) continue;
+            seen[child] = 1;
+            prev[child] = cur;
+            queue.push_back(child);
+        }
+    }
+    if (!seen[to]) return std::nullopt;
+
+    std::vector<NodeId> chain{to};
+    for (NodeId cur = to; cur != from; cur = prev[cur]) chain.push_back(prev[cur]);
+    r::reverse(chain);
+    return chain;
+}
+
+// Yen's algorithm: the `k` shortest loop-free chains from the root to `target`, shortest first.
+// Each round runs one BFS per node of the previous chain, so this is O(k * n * (n + e)).
+std::vector<std::vector<NodeId>> shortest_chains(const DepGraph& g, const NodeId target, const size_t k)
+{
+    std::vector<std::vector<NodeId>> found;
+    // Nothing loads the root, so no chain explains it.
+    if (target == g.root) return found;
+    const std::vector<char> none(g.nodes.size(), 0);
+    auto first = shortest_chain(g, g.root, target, none, {});
+    if (!first) return found;
+    found.push_back(std::move(*first));
+
+    auto shorter = [](const std::vector<NodeId>& a, const std::vector<NodeId>& b)
+    {
+        return a.size() != b.size() ? a.size() < b.size() : a < b;
+    };
+    std::set<std::vector<NodeId>, decltype(shorter)> candidates(shorter);
+
+    while (found.size() < k)
+    {
+        const auto& last = found.back();
+        for (size_t i = 0; i + 1 < last.size(); ++i)
+        {
+            const std::span<const NodeId> prefix(last.data(), i + 1);
+
+            std::vector<NodeId> skip;
+            for (const auto& chain : found)
+            {
+                if (chain.size() > i + 1 && r::equal(prefix, std::span(chain.data(), i + 1)))
+                    skip.push_back(chain[i + 1]);
+            }
+
+            std::vector<char> blocked(g.nodes.size(), 0);
+            for (const auto id : prefix.first(i)) blocked[id] = 1;
+
+            if (auto spur = shortest_chain(g, last[i], target, blocked, skip))
+            {
+                std::vector<NodeId> chain(prefix.begin(), prefix.end() - 1);
+                chain.append_range(*spur);
+                if (r::find(found, chain) == found.end()) candidates.insert(std::move(chain));
+            }
+        }
+        if (candidates.empty()) break;
+        found.push_back(std::move(candidates.extract(candidates.begin()).value()));
+    }
+    return found;
+}
+
+// Number of root..`target` chains, by DP over a DFS postorder. Edges that close a cycle are
+// dropped (those are the "(cycle)" edges of --tree), so this counts paths of the acyclic graph.
+// Saturates at UINT64_MAX.
+uint64_t count_chains(const DepGraph& g, const NodeId target)
+{
+    if (target == g.root) return 0;
+    enum : char { NEW, OPEN, DONE };
+    std::vector<char> state(g.nodes.size(), NEW);
+    std::vector<uint64_t> count(g.nodes.size(), 0);
+    std::vector<std::pair<NodeId, size_t>> stack{{g.root, 0}};
+    state[g.root] = OPEN;
+
+    while (!stack.empty())
+    {
+        auto& [cur, next] = stack.back();
+        const auto kids = g.children[cur];
+        if (next < kids.size())
+        {
+            const NodeId child = kids[next++];
+            if (state[child] == NEW)
+            {
+                state[child] = OPEN;
+                stack.emplace_back(child, 0);
+            }
+            continue;
+        }
+
+        uint64_t total = cur == target ? 1 : 0;
+        if (cur != target)
+        {
+            for (const auto child : kids)
+            {
+                if (state[child] != DONE) continue;
+                const uint64_t sum = total + count[child];
+                total = sum < total ? UINT64_MAX : sum;
+            }
+        }
+        count[cur] = total;
+        state[cur] = DONE;
+        stack.pop_back();
+    }
+    return count[g.root];
+}
+
+// Prints the shortest chain(s) from the root to the target; `limit` > 1 lists that many
+// alternatives, `count` prints how many chains there are instead.
+void explain_why(OutputWriter& out, const DepGraph& g, const std::string& target_in, bool full_path, size_t limit, bool count)
+{
+    const auto found = find_target(g, target_in);
+    if (!found)
+    {
+        out.flush();
+        std::println(std::cerr, "Library {} not found in dependency graph.", target_in);
+        return;
+    }
+    const NodeId target = *found;
+
+    if (count)
+    {
+        const uint64_t n = count_chains(g, target);
+        out.println("{}{} chain{} from {} to {}", n, n == UINT64_MAX ? "+" : "", n == 1 ? "" : "s",
+                     g.display(g.root, full_path), g.display(target, full_path));
+        return;
+    }
+
+    for (const auto& chain : shortest_chains(g, target, std::max<size_t>(limit, 1)))
+    {
+        for (size_t i = 0; i < chain.size(); ++i)
+        {
+            if (i > 0) out.write(" -> ");
+            out.write(g.display(chain[i], full_path));
+        }
+        out.write("\n");
+    }
+}
+
+// Immediate dominator of every node (Cooper, Harvey & Kennedy, "A Simple, Fast Dominance
+// Algorithm"): idom[v] is the last node every root..v chain has to pass through. idom[root] == root.
+// postorder is the DFS order the iteration ran on; a node always comes before its dominator.
+struct Dominators
+{
+    std::vector<NodeId> idom;
+    std::vector<NodeId> postorder;
+};
+
+Dominators immediate_dominators(const DepGraph& g)
+{
+    const size_t n = g.nodes.size();
+    constexpr NodeId UNDEFINED = std::numeric_limits<NodeId>::max();
+
+    std::vector<NodeId> postorder;
+    std::vector<uint32_t> po_num(n, 0);
+    std::vector<char> seen(n, 0);
+    std::vector<std::pair<NodeId, size_t>> stack{{g.root, 0}};
+    seen[g.root] = 1;
+    while (!stack.empty())
+    {
+        auto& [cur, next] = stack.back();
+        const auto kids = g.children[cur];
+        if (next < kids.size())
+        {
+            const NodeId child = kids[next++];
+            if (!seen[child])
+            {
+                seen[child] = 1;
+                stack.emplace_back(child, 0);
+            }
+            continue;
+        }
+        po_num[cur] = postorder.size();
+        postorder.push_back(cur);
+        stack.pop_back();
+    }
+
+    std::vector<NodeId> idom(n, UNDEFINED);
+    idom[g.root] = g.root;
+    auto intersect = [&](NodeId a, NodeId b)
+    {
+        while (a != b)
+        {
+            while (po_num[a] < po_num[b]) a = idom[a];
+            while (po_num[b] < po_num[a]) b = idom[b];
+        }
+        return a;
+    };
+
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (const auto id : postorder | v::reverse)
+        {
+            if (id == g.root) continue;
+            NodeId new_idom = UNDEFINED;
+            for (const auto p : g.parents[id])
+            {
+                if (idom[p] == UNDEFINED) continue;
+                new_idom = new_idom == UNDEFINED ? p : intersect(p, new_idom);
+            }
+            if (new_idom != idom[id])
+            {
+                idom[id] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    return {std::move(idom), std::move(postorder)};
+}
+
+// --dominators: for every library, how many libraries (itself included) and mapped bytes (the
+// load size --cost uses) would disappear from the graph if it were dropped, i.e. the size of its
+// dominator subtree.
+void print_dominators(OutputWriter& out, DepGraph& g, bool full_path, bool no_header, bool use_color)
+{
+    const auto [idom, postorder] = immediate_dominators(g);
+    const size_t n = g.nodes.size();
+
+    std::vector<uint64_t> libs(n, 1);
+    std::vector<uint64_t> bytes(n, 0);
+    for (NodeId id = 0; id < n; ++id)
+    {
+        if (g.nodes[id].path.empty()) continue;
+        if (const auto dyn = g.load_dynamic(g.nodes[id].path)) bytes[id] = dyn->cost.load_size;
+    }
+
+    // Postorder reaches every node before its dominator, so subtrees fold bottom-up in one pass.
+    for (const auto id : postorder)
+    {
+        if (id == g.root) continue;
+        libs[idom[id]] += libs[id];
+        bytes[idom[id]] += bytes[id];
+    }
+
+    std::vector<NodeId> order(n);
+    std::iota(order.begin(), order.end(), NodeId{0});
+    r::sort(order, [&](NodeId a, NodeId b)
+    {
+        if (libs[a] != libs[b]) return libs[a] > libs[b];
+        if (bytes[a] != bytes[b]) return bytes[a] > bytes[b];
+        return g.name(a) < g.name(b);
+    });
+
+    size_t w = 0;
+    for (NodeId id = 0; id < n; ++id) w = std::max(w, g.display(id, full_path).length());
+
+    const std::string bold = use_color ? "\033[1m" : "";
+    const std::string reset = use_color ? "\033[0m" : "";
+    if (!no_header)
+    {
+        out.println("{}{:<{}}  {:>6} {:>12}  {}{}", bold, "Library", w + 2, "Libs", "Bytes", "Dominator", reset);
+    }
+    for (const auto id : order)
+    {
+        out.println("{:<{}}  {:>6} {:>12}  {}", g.display(id, full_path), w + 2, libs[id], bytes[id],
+                     id == g.root ? "-" : g.display(idom[id], full_path));
+    }
+}
+
+// --cost: ranks objects by estimated ld.so startup work. Relative relocations are one write
+// each; every symbol lookup (symbolic relocations, plus PLT slots under BIND_NOW) searches the
+// global scope, on average half of it, where each object costs one probe with a GNU_HASH bloom
+// filter and SYSV_PROBES when it only has a SYSV hash table.
+void print_cost(OutputWriter& out, DepGraph& g, bool full_path, bool no_header, bool use_color)
+{
+    constexpr uint64_t SYSV_PROBES = 4;
+
+    struct Row
+    {
+        NodeId id;
+        LinkCost cost;
+        uint64_t lookups;
+        uint64_t estimate;
+    };
+
+    std::vector<Row> rows;
+    uint64_t scope_probes = 0;
+    for (NodeId id = 0; id < g.nodes.size(); ++id)
+    {
+        if (g.nodes[id].path.empty()) continue;
+        const auto info = g.load_dynamic(g.nodes[id].path);
+        if (!info) continue;
+        const auto& c = info->cost;
+        if (c.flags & LinkCost::GNU_HASH) scope_probes += 1;
+        else if (c.flags & LinkCost::SYSV_HASH) scope_probes += SYSV_PROBES;
+        const uint64_t lookups = c.symbolic_relocs + ((c.flags & LinkCost::BIND_NOW) ? c.plt_relocs : 0);
+        rows.push_back({id, c, lookups, 0});
+    }
+    for (auto& row : rows) row.estimate = row.cost.relative_relocs + row.lookups * std::max<uint64_t>(scope_probes / 2, 1);
+
+    r::sort(rows, [&](const Row& a, const Row& b)
+    {
+        if (a.estimate != b.estimate) return a.estimate > b.estimate;
+        return g.name(a.id) < g.name(b.id);
+    });
+
+    size_t w = 5;
+    for (const auto& row : rows) w = std::max(w, g.display(row.id, full_path).length());
+
+    auto hash_name = [](uint32_t flags) -> std::string_view
+    {
+        const bool gnu = flags & LinkCost::GNU_HASH;
+        const bool sysv = flags & LinkCost::SYSV_HASH;
+        return gnu && sysv ? "both" : gnu ? "gnu" : sysv ? "sysv" : "-";
+    };
+
+    const std::string bold = use_color ? "\033[1m" : "";
+    const std::string reset = use_color ? "\033[0m" : "";
+    if (!no_header)
+    {
+        out.println("{}{:<{}}  {:>9} {:>9} {:>7} {:>4} {:>5} {:>8} {:>8} {:>11} {:>12}{}", bold, "Library", w + 2,
+                     "Relative", "Symbolic", "PLT", "Now", "Hash", "Exports", "Imports", "Mapped", "Cost", reset);
+    }
+
+    LinkCost total;
+    uint64_t total_estimate = 0;
+    for (const auto& row : rows)
+    {
+        const auto& c = row.cost;
+        out.println("{:<{}}  {:>9} {:>9} {:>7} {:>4} {:>5} {:>8} {:>8} {:>11} {:>12}", g.display(row.id, full_path),
+                     w + 2, c.relative_relocs, c.symbolic_relocs, c.plt_relocs,
+                     (c.flags & LinkCost::BIND_NOW) ? "yes" : "no", hash_name(c.flags), c.exported, c.imported,
+                     c.load_size, row.estimate);
+        total.relative_relocs += c.relative_relocs;
+        total.symbolic_relocs += c.symbolic_relocs;
+        total.plt_relocs += c.plt_relocs;
+        total.exported += c.exported;
+        total.imported += c.imported;
+        total.load_size += c.load_size;
+        total_estimate += row.estimate;
+    }
+    out.println("{}{:<{}}  {:>9} {:>9} {:>7} {:>4} {:>5} {:>8} {:>8} {:>11} {:>12}{}", bold, "total", w + 2,
+                 total.relative_relocs, total.symbolic_relocs, total.plt_relocs, "", "", total.exported,
+                 total.imported, total.load_size, total_estimate, reset);
+}
+
+// --footprint: mapped memory per object, split by segment kind. Subtree is the writable
+// (private, per-process) memory of everything reachable through an object's children, each
+// file counted once however many paths lead to it: what depending on it costs every process.
+void print_footprint(OutputWriter& out, DepGraph& g, bool full_path, bool no_header, bool use_color)
+{
+    const size_t n = g.nodes.size();
+    std::vector<std::optional<Footprint>> sizes(n);
+    for (NodeId id = 0; id < n; ++id)
+    {
+        if (g.nodes[id].path.empty()) continue;
+        if (auto info = g.load_dynamic(g.nodes[id].path)) sizes[id] = info->footprint;
+    }
+
+    // The set reachable from each node as a bitset, one per strongly connected component (DT_NEEDED
+    // cycles do occur). Tarjan's algorithm completes a component only after every component it
+    // reaches, so each set is its members plus the union of already finished sets.
+    constexpr NodeId NONE = std::numeric_limits<NodeId>::max();
+    const size_t words = (n + 63) / 64;
+    std::vector<uint64_t> reach;
+    std::vector<NodeId> comp(n, NONE), index(n, NONE), low(n, 0), open, members;
+    std::vector<uint64_t> subtree(n, 0);
+    NodeId next_index = 0, comps = 0;
+    std::vector<std::pair<NodeId, size_t>> stack;
+    for (NodeId start = 0; start < n; ++start)
+    {
+        if (index[start] != NONE) continue;
+        index[start] = low[start] = next_index++;
+        open.push_back(start);
+        stack.assign(1, {start, 0});
+        while (!stack.empty())
+        {
+            auto& [cur, next] = stack.back();
+            const auto kids = g.children[cur];
+            if (next < kids.size())
+            {
+                const NodeId child = kids[next++];
+                if (index[child] == NONE)
+                {
+                    index[child] = low[child] = next_index++;
+                    open.push_back(child);
+                    stack.emplace_back(child, 0);
+                }
+                else if (comp[child] == NONE)
+                {
+                    low[cur] = std::min(low[cur], index[child]);
+                }
+                continue;
+            }
+            const NodeId done = cur;
+            stack.pop_back();
+            if (!stack.empty()) low[stack.back().first] = std::min(low[stack.back().first], low[done]);
+            if (low[done] != index[done]) continue;
+
+            members.clear();
+            do
+            {
+                members.push_back(open.back());
+                open.pop_back();
+                comp[members.back()] = comps;
+            } while (members.back() != done);
+
+            reach.resize(reach.size() + words, 0);
+            uint64_t* bits = reach.data() + static_cast<size_t>(comps) * words;
+            for (const auto m : members)
+            {
+                bits[m / 64] |= uint64_t{1} << (m % 64);
+                for (const auto child : g.children[m])
+                {
+                    if (comp[child] == comps) continue;
+                    const uint64_t* sub = reach.data() + static_cast<size_t>(comp[child]) * words;
+                    for (size_t w = 0; w < words; ++w) bits[w] |= sub[w];
+                }
+            }
+
+            uint64_t total = 0;
+            for (size_t w = 0; w < words; ++w)
+            {
+                for (uint64_t word = bits[w]; word; word &= word - 1)
+                {
+                    const auto id = static_cast<NodeId>(w * 64 + std::countr_zero(word));
+                    if (sizes[id]) total += sizes[id]->writable();
+                }
+            }
+            for (const auto m : members) subtree[m] = total;
+            ++comps;
+        }
+    }
+
+    std::vector<NodeId> rows;
+    for (NodeId id = 0; id < n; ++id)
+    {
+        if (sizes[id]) rows.push_back(id);
+    }
+    r::sort(rows, [&](NodeId a, NodeId b)
+    {
+        if (subtree[a] != subtree[b]) return subtree[a] > subtree[b];
+        return g.name(a) < g.name(b);
+    });
+
+    size_t w = 5;
+    for (const auto id : rows) w = std::max(w, g.display(id, full_path).length());
+
+    const std::string bold = use_color ? "\033[1m" : "";
+    const std::string reset = use_color ? "\033[0m" : "";
+    if (!no_header)
+    {
+        out.println("{}{:<{}}  {:>11} {:>11} {:>10} {:>10} {:>10} {:>10} {:>11}{}", bold, "Library", w + 2, "Text",
+                     "Rodata", "Data", "Bss", "Relro", "Writable", "Subtree", reset);
+    }
+
+    Footprint total;
+    for (const auto id : rows)
+    {
+        const auto& f = *sizes[id];
+        out.println("{:<{}}  {:>11} {:>11} {:>10} {:>10} {:>10} {:>10} {:>11}", g.display(id, full_path), w + 2,
+                     f.text, f.rodata, f.data, f.bss, f.relro, f.writable(), subtree[id]);
+        total += f;
+    }
+    out.println("{}{:<{}}  {:>11} {:>11} {:>10} {:>10} {:>10} {:>10} {:>11}{}", bold, "total", w + 2, total.text,
+                 total.rodata, total.data, total.bss, total.relro, total.writable(), "", reset);
+}
+
+// --unused: replays ld.so symbol binding. The global scope is the graph in load order
+// (breadth-first from the root, DT_NEEDED order within an object) and every undefined symbol
+// binds to the first object in it that exports the name (and version, if it asks for one).
+// A DT_NEEDED entry that receives no binding from the object listing it is reported; objects
+// whose symbol tables can't be read are never reported.
+void print_unused(OutputWriter& out, const DepGraph& g, bool full_path, bool no_header, bool use_color)
+{
+    constexpr NodeId NONE = std::numeric_limits<NodeId>::max();
+    const auto [tables, scope] = g.symbol_scope();
+
+    // The first two definers of each name in scope, searched once per name however many objects
+    // import it. The second one serves a copy relocation whose own object comes first.
+    std::unordered_map<std::string_view, std::pair<NodeId, NodeId>, GnuHash, std::equal_to<>> definers;
+    auto provider = [&](std::string_view name, NodeId skip) -> std::optional<NodeId>
+    {
+        auto [it, inserted] = definers.try_emplace(name, NONE, NONE);
+        auto& [first, second] = it->second;
+        if (inserted)
+        {
+            const uint32_t hash = GnuHash::of(name);
+            for (const auto id : scope)
+            {
+                if (!tables[id]->defines(name, hash)) continue;
+                if (first != NONE)
+                {
+                    second = id;
+                    break;
+                }
+                first = id;
+            }
+        }
+        const NodeId hit = first != skip ? first : second;
+        if (hit == NONE) return std::nullopt;
+        return hit;
+    };
+
+    std::vector<std::pair<NodeId, NodeId>> unused;
+    std::vector<char> bound(g.nodes.size(), 0);
+    for (const auto id : scope)
+    {
+        std::vector<NodeId> targets;
+        for (const auto& name : tables[id]->imports)
+        {
+            if (auto p = provider(name, NONE)) targets.push_back(*p);
+        }
+        for (const auto& name : tables[id]->copies)
+        {
+            if (auto p = provider(name, id)) targets.push_back(*p);
+        }
+
+        for (const auto t : targets) bound[t] = 1;
+        for (const auto child : g.children[id])
+        {
+            if (tables[child] && !bound[child]) unused.emplace_back(id, child);
+        }
+        for (const auto t : targets) bound[t] = 0;
+    }
+
+    r::sort(unused, {}, [&](const auto& e) { return std::pair(g.name(e.first), g.name(e.second)); });
+
+    size_t w = 7;
+    for (const auto& [obj, dep] : unused) w = std::max(w, g.display(obj, full_path).length());
+
+    const std::string bold = use_color ? "\033[1m" : "";
+    const std::string reset = use_color ? "\033[0m" : "";
+    if (!no_header) out.println("{}{:<{}}  {}{}", bold, "Library", w + 2, "Unused DT_NEEDED", reset);
+    for (const auto& [obj, dep] : unused)
+    {
+        out.println("{:<{}}  {}", g.display(obj, full_path), w + 2, g.display(dep, full_path));
+    }
+}
+
+// --interpose: exported symbols defined by more than one loaded object. The first definition in
+// load order wins every lookup that reaches it; the others are shadowed. Definitions are grouped
+// by bare name: an unversioned one (an allocator's malloc) collides with every other, versioned
+// ones only with the same version, so two sonames of one library don't collide. Symbols the
+// linker adds to every object are left out.
+void print_interpose(OutputWriter& out, const DepGraph& g, bool full_path, bool no_header, bool use_color)
+{
+    constexpr std::array<std::string_view, 5> LINKER_SYMBOLS = {"_init", "_fini", "_edata", "_end", "__bss_start"};
+    constexpr uint32_t UNIQUE = std::numeric_limits<uint32_t>::max();
+
+    const auto [tables, scope] = g.symbol_scope();
+
+    // One lookup target: the winning spelling, with the definitions it shadows.
+    struct Definers
+    {
+        std::string_view name;
+        std::optional<std::string_view> version;
+        NodeId winner;
+        uint32_t shadowed = UNIQUE;
+    };
+
+    size_t total = 0;
+    for (const auto id : scope) total += tables[id]->definitions.size();
+
+    std::vector<Definers> targets;
+    targets.reserve(total);
+    std::unordered_map<std::string_view, std::vector<uint32_t>, GnuHash, std::equal_to<>> by_name;
+    by_name.reserve(total);
+    std::vector<std::vector<NodeId>> shadowed;
+    for (const auto id : scope)
+    {
+        for (const auto name : tables[id]->definitions)
+        {
+            const auto at = name.find('@');
+            const auto bare = name.substr(0, at);
+            if (r::find(LINKER_SYMBOLS, bare) != LINKER_SYMBOLS.end()) continue;
+            const auto version = at == std::string_view::npos ? std::nullopt : std::optional(name.substr(at + 1));
+
+            // An unversioned definition shadowed by a versioned one still wins lookups of
+            // the other versions, so it gets a target of its own unless one exists.
+            auto& group = by_name[bare];
+            bool collided = false;
+            for (const auto t : group)
+            {
+                auto& d = targets[t];
+                if (version && d.version && *version != *d.version) continue;
+                if (d.winner == id) continue;
+                collided |= version.has_value() || !d.version;
+                if (d.shadowed == UNIQUE)
+                {
+                    d.shadowed = shadowed.size();
+                    shadowed.emplace_back();
+                }
+                if (r::find(shadowed[d.shadowed], id) == shadowed[d.shadowed].end()) shadowed[d.shadowed].push_back(id);
+            }
+            if (!collided)
+            {
+                group.push_back(static_cast<uint32_t>(targets.size()));
+                targets.push_back({name, version, id});
+            }
+        }
+    }
+
+    std::vector<std::pair<std::string_view, const Definers*>> rows;
+    rows.reserve(shadowed.size());
+    for (const auto& d : targets)
+    {
+        if (d.shadowed != UNIQUE) rows.emplace_back(d.name, &d);
+    }
+    r::sort(rows, {}, [](const auto& row) { return row.first; });
+
+    size_t sym_w = 6;
+    size_t lib_w = 6;
+    for (const auto& [name, d] : rows)
+    {
+        sym_w = std::max(sym_w, name.length());
+        lib_w = std::max(lib_w, g.display(d->winner, full_path).length());
+    }
+
+    const std::string bold = use_color ? "\033[1m" : "";
+    const std::string reset = use_color ? "\033[0m" : "";
+    if (!no_header)
+    {
+        out.println("{}{:<{}}  {:<{}}  {}{}", bold, "Symbol", sym_w + 2, "Winner", lib_w + 2, "Shadowed", reset);
+    }
+    for (const auto& [name, d] : rows)
+    {
+        std::string others;
+        for (const auto id : shadowed[d->shadowed])
+        {
+            if (!others.empty()) others += ", ";
+            others += g.display(id, full_path);
+        }
+        out.println("{:<{}}  {:<{}}  {}", name, sym_w + 2, g.display(d->winner, full_path), lib_w + 2, others);
+    }
+}
+
+// --ndjson: one JSON object per line, a "node" record for every node in id order followed by
+// one "binary" record, so consumers can process a batch run binary by binary.
+void print_ndjson(OutputWriter& out, const DepGraph& g)
+{
+    std::string buffer;
+    auto emit = [&](const auto& record)
+    {
+        buffer.clear();
+        if (glz::write_json(record, buffer))
+        {
+            out.flush();
+            std::println(std::cerr, "Error writing JSON");
+            return;
+        }
+        out.write(buffer);
+        out.write("\n");
+    };
+
+    const std::string_view binary = g.nodes[g.root].path;
+    NdjsonNode node;
+    node.binary = binary;
+    size_t missing = 0;
+    for (NodeId id = 0; id < g.nodes.size(); ++id)
+    {
+        const auto& n = g.nodes[id];
+        if (n.path.empty()) ++missing;
+        node.name = g.display(id, false);
+        node.path = n.path;
+        node.pkg = n.pkg;
+        node.depth = n.depth;
+        node.parents.clear();
+        for (const auto p : g.parents[id]) node.parents.push_back(g.display(p, false));
+        node.children.clear();
+        for (const auto c : g.children[id]) node.children.push_back(g.display(c, false));
+        emit(node);
+    }
+
+    NdjsonBinary summary;
+    summary.binary = binary;
+    summary.libraries = g.nodes.size() - 1;
+    summary.missing = missing;
+    summary.minimal_packages = g.get_minimal_pkgs();
+    emit(summary);
+    out.flush();
+}
+
+// --watch: the edges and packages of a binary's graph that appeared or went away between two
+// builds, as one "diff" record. Nodes are keyed by path (name when unresolved), so a library that
+// now resolves to another file shows up as one removed and one added edge. `before` is null for
+// the first build, which reports the whole graph as added. Prints nothing if nothing changed.
+void print_graph_diff(OutputWriter& out, const DepGraph* before, const DepGraph& after)
+{
+    using Edge = std::pair<std::string_view, std::string_view>;
+    auto key = [](const DepGraph& g, NodeId id) -> std::string_view
+    {
+        return g.nodes[id].path.empty() ? std::string_view(g.names[id]) : std::string_view(g.nodes[id].path);
+    };
+    auto edges_of = [&](const DepGraph* g)
+    {
+        std::vector<Edge> edges;
+        for (NodeId id = 0; g && id < g->nodes.size(); ++id)
+        {
+            for (const auto child : g->children[id]) edges.emplace_back(key(*g, id), key(*g, child));
+        }
+        r::sort(edges);
+        edges.erase(r::unique(edges).begin(), edges.end());
+        return edges;
+    };
+    auto packages_of = [](const DepGraph* g)
+    {
+        std::vector<std::string_view> pkgs;
+        if (!g) return pkgs;
+        for (const auto& n : g->nodes)
+        {
+            if (!n.pkg.empty() && n.pkg != "-") pkgs.push_back(n.pkg);
+        }
+        r::sort(pkgs);
+        pkgs.erase(r::unique(pkgs).begin(), pkgs.end());
+        return pkgs;
+    };
+
+    const auto old_edges = edges_of(before);
+    const auto new_edges = edges_of(&after);
+    const auto old_pkgs = packages_of(before);
+    const auto new_pkgs = packages_of(&after);
+
+    NdjsonDiff diff;
+    diff.binary = after.nodes[after.root].path;
+    auto to_record = [](const Edge& e) { return NdjsonEdge{e.first, e.second}; };
+    std::vector<Edge> edges;
+    r::set_difference(new_edges, old_edges, std::back_inserter(edges));
+    diff.added_edges = edges | v::transform(to_record) | r::to<std::vector<NdjsonEdge>>();
+    edges.clear();
+    r::set_difference(old_edges, new_edges, std::back_inserter(edges));
+    diff.removed_edges = edges | v::transform(to_record) | r::to<std::vector<NdjsonEdge>>();
+    r::set_difference(new_pkgs, old_pkgs, std::back_inserter(diff.added_packages));
+    r::set_difference(old_pkgs, new_pkgs, std::back_inserter(diff.removed_packages));
+
+    if (before && diff.added_edges.empty() && diff.removed_edges.empty() && diff.added_packages.empty() &&
+        diff.removed_packages.empty())
+        return;
+
+    std::string buffer;
+    if (glz::write_json(diff, buffer))
+    {
+        out.flush();
+        std::println(std::cerr, "Error writing JSON");
+        return;
+    }
+    out.write(buffer);
+    out.write("\n");
+    out.flush();
+}
+
+// --rdeps: every indexed file that loads `lib`, directly or through other libraries, nearest
+// first. Via is the library through which the file was reached.
+int print_rdeps(OutputWriter& out, const ReverseIndex& index, std::string_view lib, bool no_header, bool use_color)
+{
+    const auto targets = index.find(lib);
+    if (targets.empty())
+    {
+        out.flush();
+        std::println(std::cerr, "Error: {} not found in the reverse index.", lib);
+        return 1;
+    }
+
+    constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> depth(index.size(), NONE);
+    std::vector<uint32_t> via(index.size(), NONE);
+    std::vector<uint32_t> queue;
+    for (const auto t : targets)
+    {
+        depth[t] = 0;
+        queue.push_back(t);
+    }
+    for (size_t head = 0; head < queue.size(); ++head)
+    {
+        const auto cur = queue[head];
+        for (const auto user : index.users_of(cur))
+        {
+            if (depth[user] != NONE) continue;
+            depth[user] = depth[cur] + 1;
+            via[user] = cur;
+            queue.push_back(user);
+        }
+    }
+
+    r::sort(queue, {}, [&](uint32_t i) { return std::pair(depth[i], index.path(i)); });
+
+    size_t w = 4;
+    for (const auto i : queue) w = std::max(w, index.path(i).length());
+
+    const std::string bold = use_color ? "\033[1m" : "";
+    const std::string reset = use_color ? "\033[0m" : "";
+    if (!no_header) out.println("{}{:<{}}  {:<5}  {}{}", bold, "File", w + 2, "Depth", "Via", reset);
+    for (const auto i : queue)
+    {
+        out.println("{:<{}}  {:<5}  {}", index.path(i), w + 2, depth[i], via[i] == NONE ? "-" : index.name(via[i]));
+    }
+    return 0;
+}
+
+// --diff: the libraries of one side of a comparison, from a graph just built or from a saved
+// --json document. Entries are keyed by display name, as in the --json output; the root is left
+// out, so two builds of one program compare even when their file names differ.
+struct GraphSnapshot
+{
+    struct Library
+    {
+        std::string name;
+        std::string path;
+        std::string pkg;
+        int depth = 0;
+    };
+
+    std::string root;
+    std::vector<Library> libraries;
+    std::vector<std::string> minimal_packages;
+
+    static GraphSnapshot from_graph(const DepGraph& g)
+    {
+        GraphSnapshot snap{g.root_name, {}, g.get_minimal_pkgs()};
+        for (NodeId id = 0; id < g.nodes.size(); ++id)
+        {
+            if (id == g.root) continue;
+            const auto& n = g.nodes[id];
+            snap.libraries.push_back({g.display(id, false), n.path, n.pkg, n.depth});
+        }
+        return snap;
+    }
+
+    static std::optional<GraphSnapshot> from_json(const std::string& path)
+    {
+        std::ifstream f(path, std::ios::binary);
+        const std::string buffer{std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
+        JsonOutput doc;
+        if (const auto ec = glz::read_json(doc, buffer))
+        {
+            std::println(std::cerr, "Error: {}: not an ELF file or --json output: {}", path,
+                         glz::format_error(ec, buffer));
+            return std::nullopt;
+        }
+
+        GraphSnapshot snap{std::move(doc.root), {}, std::move(doc.minimal_packages)};
+        for (auto& [name, fields] : doc.dependencies)
+        {
+            int depth = 0;
+            const auto& d = fields["depth"];
+            std::from_chars(d.data(), d.data() + d.size(), depth);
+            if (depth == 0) continue;
+            snap.libraries.push_back({name, std::move(fields["path"]), std::move(fields["pkg"]), depth});
+        }
+        return snap;
+    }
+};
+
+struct JsonDiffEntry
+{
+    std::string_view name;
+    std::string_view change;
+    std::string before;
+    std::string after;
+};
+
+struct JsonDiff
+{
+    std::string_view before;
+    std::string_view after;
+    std::vector<JsonDiffEntry> libraries;
+    std::vector<std::string_view> added_packages;
+    std::vector<std::string_view> removed_packages;
+};
+
+// --diff: libraries added and removed between two snapshots, and for the ones in both a changed
+// path, package or depth, then the change in the minimal package set. Names are interned once,
+// so matching is one pass over each side. True if anything differs.
+bool print_snapshot_diff(OutputWriter& out, const GraphSnapshot& a, const GraphSnapshot& b, bool json, bool no_header,
+                         bool use_color)
+{
+    constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+    std::unordered_map<std::string_view, uint32_t> ids;
+    std::vector<std::array<uint32_t, 2>> sides;
+    auto index = [&](const GraphSnapshot& snap, size_t side)
+    {
+        for (uint32_t i = 0; i < snap.libraries.size(); ++i)
+        {
+            const auto [it, inserted] = ids.try_emplace(snap.libraries[i].name, static_cast<uint32_t>(sides.size()));
+            if (inserted) sides.push_back({NONE, NONE});
+            sides[it->second][side] = i;
+        }
+    };
+    index(a, 0);
+    index(b, 1);
+
+    auto location = [](const GraphSnapshot::Library& lib) { return lib.path.empty() ? "not found" : lib.path; };
+    auto package = [](const GraphSnapshot::Library& lib) { return lib.pkg.empty() ? "-" : lib.pkg; };
+
+    JsonDiff diff{a.root, b.root, {}, {}, {}};
+    for (const auto& [ia, ib] : sides)
+    {
+        if (ib == NONE)
+        {
+            const auto& lib = a.libraries[ia];
+            diff.libraries.push_back({lib.name, "removed", location(lib), "-"});
+            continue;
+        }
+        const auto& after = b.libraries[ib];
+        if (ia == NONE)
+        {
+            diff.libraries.push_back({after.name, "added", "-", location(after)});
+            continue;
+        }
+        const auto& before = a.libraries[ia];
+        if (before.path != after.path) diff.libraries.push_back({after.name, "path", location(before), location(after)});
+        if (before.pkg != after.pkg) diff.libraries.push_back({after.name, "pkg", package(before), package(after)});
+        if (before.depth != after.depth)
+        {
+            diff.libraries.push_back({after.name, "depth", std::to_string(before.depth), std::to_string(after.depth)});
+        }
+    }
+    r::sort(diff.libraries, {}, [](const JsonDiffEntry& e) { return std::pair(e.name, e.change); });
+
+    std::unordered_set<std::string_view> old_pkgs(a.minimal_packages.begin(), a.minimal_packages.end());
+    std::unordered_set<std::string_view> new_pkgs(b.minimal_packages.begin(), b.minimal_packages.end());
+    for (const auto& p : b.minimal_packages)
+    {
+        if (!old_pkgs.contains(p)) diff.added_packages.push_back(p);
+    }
+    for (const auto& p : a.minimal_packages)
+    {
+        if (!new_pkgs.contains(p)) diff.removed_packages.push_back(p);
+    }
+    const bool differs =
+        !diff.libraries.empty() || !diff.added_packages.empty() || !diff.removed_packages.empty();
+
+    if (json)
+    {
+        std::string buffer;
+        if (glz::write_json(diff, buffer))
+        {
+            out.flush();
+            std::println(std::cerr, "Error writing JSON");
+            return differs;
+        }
+        out.write(buffer);
+        out.write("\n");
+        return differs;
+    }
+
+    size_t name_w = 7;
+    size_t before_w = 6;
+    for (const auto& e : diff.libraries)
+    {
+        name_w = std::max(name_w, e.name.length());
+        before_w = std::max(before_w, e.before.length());
+    }
+
+    const std::string bold = use_color ? "\033[1m" : "";
+    const std::string reset = use_color ? "\033[0m" : "";
+    if (!no_header && !diff.libraries.empty())
+    {
+        out.println("{}{:<{}}  {:<7}  {:<{}}  {}{}", bold, "Library", name_w + 2, "Change", "Before", before_w + 2,
+                    "After", reset);
+    }
+    for (const auto& e : diff.libraries)
+    {
+        out.println("{:<{}}  {:<7}  {:<{}}  {}", e.name, name_w + 2, e.change, e.before, before_w + 2, e.after);
+    }
+
+    if (!diff.added_packages.empty() || !diff.removed_packages.empty())
+    {
+        std::string line;
+        for (const auto& p : diff.added_packages) line += std::format(" +{}", p);
+        for (const auto& p : diff.removed_packages) line += std::format(" -{}", p);
+        out.println("{}Minimal packages:{}", diff.libraries.empty() ? "" : "\n", line);
+    }
+    return differs;
+}
+
+void generate_completions(OutputWriter& out, const CLI::App& app, const std::string& shell)
+{
+    std::vector<const CLI::Option*> all_options = app.get_options();
+    for (const auto* group : app.get_subcommands([](const CLI::App*) { return true; }))
+    {
+        for (const auto* opt : group->get_options())
+        {
+            all_options.push_back(opt);
+        }
+    }
+
+    if (shell == "fish")
+    {
+        out.println("# fish completion for inspect-deps");
+
+        for (const auto* opt : all_options)
+        {
+            if (opt->get_name().empty()) continue;
+
+            std::string short_opt;
+            std::string long_opt;
+
+            for (const auto& name : opt->get_snames()) short_opt = name;
+            for (const auto& name : opt->get_lnames()) long_opt = name;
+
+            if (short_opt.empty() && long_opt.empty()) continue;
+
+            out.print("complete -c inspect-deps");
+            if (!short_opt.empty()) out.print(" -s {}", short_opt);
+            if (!long_opt.empty()) out.print(" -l {}", long_opt);
+            out.print(" -d \"{}\"", opt->get_description());
+
+            if (long_opt == "completions")
+            {
+                out.print(" -a \"bash zsh fish\"");
+            }
+            else if (opt->get_expected() > 0)
+            {
+                out.print(" -r");
+            }
+
+            out.println("");
+        }
+
+        out.println("complete -c inspect-deps -a \"(__fish_complete_path)\"");
+    }
+    else if (shell == "zsh")
+    {
+        out.println("#compdef inspect-deps=inspect-deps");
+        out.println("_arguments -s \\");
+
+        for (const auto* opt : all_options)
+        {
+            if (opt->get_name().empty()) continue;
+
+            std::string short_opt;
+            std::string long_opt;
+            for (const auto& name : opt->get_snames()) short_opt = name;
+            for (const auto& name : opt->get_lnames()) long_opt = name;
+
+            if (short_opt.empty() && long_opt.empty()) continue;
+
+            out.print("    '");
+            if (!short_opt.empty()) out.print("-{}", short_opt);
+            if (!long_opt.empty())
+            {
+                if (!short_opt.empty()) out.print(",");
+                out.print("--{}", long_opt);
+                if (opt->get_expected() > 0) out.print("=");
+            }
+
+            out.print("[{}]", opt->get_description());
 
-        while (!stack.empty())
+            if (long_opt == "completions")
+            {
+                out.print(":completion:(bash zsh fish)");
+            }
+            else if (opt->get_expected() > 0)
+            {
+                out.print(":file:_files");
+            }
+            out.println("' \\");
+        }
+        out.println("    '*:elf file:_files'");
+    }
+    else if (shell == "bash")
+    {
+        out.println("# bash completion for inspect-deps");
+        out.println("_inspect_deps() {{");
+        out.println("    local cur prev opts");
+        out.println("    COMPREPLY=()");
+        out.println("    cur=\"${{COMP_WORDS[COMP_CWORD]}}\"");
+        out.println("    prev=\"${{COMP_WORDS[COMP_CWORD-1]}}\"");
+
+        out.print("    opts=\"");
+        for (const auto* opt : all_options)
         {
-            auto [cur, inherited] = stack.back();
-            stack.pop_back();
+            for (const auto& name : opt->get_snames()) out.print("-{} ", name);
+            for (const auto& name : opt->get_lnames()) out.print("--{} ", name);
+        }
+        out.println("\"");
+
+        out.println("    if [[ ${{prev}} == \"--completions\" ]]; then");
+        out.println("        COMPREPLY=( $(compgen -W \"bash zsh fish\" -- ${{cur}}) )");
+        out.println("        return 0");
+        out.println("    fi");
+
+        out.println("    if [[ ${{cur}} == -* ]]; then");
+        out.println("        COMPREPLY=( $(compgen -W \"${{opts}}\" -- ${{cur}}) )");
+        out.println("        return 0");
+        out.println("    fi");
+        out.println("    COMPREPLY=( $(compgen -f -- ${{cur}}) )");
+        out.println("}}");
+        out.println("complete -F _inspect_deps inspect-deps");
+    }
+}
 
-            std::string cur_path = nodes[cur].path;
-            if (cur_path.empty()) continue;
+struct OutputOptions
+{
+    bool show_tree = false;
+    bool show_json = false;
+    bool show_ndjson = false;
+    bool show_pkg_list = false;
+    bool show_dot = false;
+    bool show_dominators = false;
+    bool show_cost = false;
+    bool show_unused = false;
+    bool show_interpose = false;
+    bool show_footprint = false;
+    bool no_header = false;
+    bool no_pkg = false;
+    bool show_full_path = false;
+    bool use_color = false;
+    std::string why_lib;
+    size_t why_limit = 1;
+    bool why_count = false;
+    std::string rdeps_lib;
+    bool watch = false;
+    std::vector<std::string> diff_paths;
+};
 
-            ELFIO::elfio reader;
-            if (!reader.load(cur_path)) continue;
+int print_graph(OutputWriter& out, DepGraph& graph, const OutputOptions& opt)
+{
+    Stats::Scope scope(Stats::OUTPUT);
+    if (opt.show_ndjson)
+    {
+        print_ndjson(out, graph);
+    }
+    else if (opt.show_json)
+    {
+        std::map<std::string, std::map<std::string, std::string>> out_deps;
+        for (NodeId id = 0; id < graph.nodes.size(); ++id)
+        {
+            const auto& n = graph.nodes[id];
+            out_deps[graph.display(id, false)] = {
+                {"path", n.path},
+                {"pkg", n.pkg},
+                {"depth", std::to_string(n.depth)}
+            };
+        }
 
-            std::vector<std::string> needed;
-            std::vector<std::string> my_rpaths;
-            std::vector<std::string> my_runpaths;
+        auto minimal = graph.get_minimal_pkgs();
 
-            if (auto* dyn_sec = reader.sections[".dynamic"])
+        JsonOutput doc{graph.root_name, out_deps, minimal};
+        std::string buffer;
+        if (glz::write_json(doc, buffer))
+        {
+            out.flush();
+            std::println(std::cerr, "Error writing JSON");
+        }
+        out.write(buffer);
+        out.write("\n");
+    }
+    else if (opt.show_tree)
+    {
+        print_tree(out, graph, graph.root, !opt.no_pkg && graph.cache->alpm.is_available(), opt.use_color,
+                   opt.show_full_path);
+    }
+    else if (opt.show_pkg_list)
+    {
+        if (!graph.cache->alpm.is_available())
+        {
+            out.flush();
+            std::println(std::cerr, "Error: libalpm not loaded. Cannot resolve packages.");
+            return 1;
+        }
+        auto pkgs = graph.get_minimal_pkgs();
+        for (size_t i = 0; i < pkgs.size(); ++i)
+        {
+            out.print("{}{}", pkgs[i], (i == pkgs.size() - 1 ? "" : " "));
+        }
+        out.write("\n");
+    }
+    else if (!opt.why_lib.empty())
+    {
+        explain_why(out, graph, opt.why_lib, opt.show_full_path, opt.why_limit, opt.why_count);
+    }
+    else if (opt.show_dot)
+    {
+        out.println("digraph deps {{");
+        out.println("  rankdir=LR;");
+        for (NodeId p = 0; p < graph.nodes.size(); ++p)
+        {
+            for (const auto c : graph.children[p])
             {
-                ELFIO::dynamic_section_accessor dyn(reader, dyn_sec);
-                for (ELFIO::Elf_Xword i = 0; i < dyn.get_entries_num(); ++i)
-                {
-                    ELFIO::Elf_Xword tag, value;
-                    std::string str;
-                    dyn.get_entry(i, tag, value, str);
-                    if (tag == ELFIO::DT_NEEDED) needed.push_back(str);
-                    else if (tag == ELFIO::DT_RPATH) my_rpaths = split_path(str);
-                    else if (tag == ELFIO::DT_RUNPATH) my_runpaths = split_path(str);
-                }
+                out.println(R"(  "{}" -> "{}";)", graph.display(p, opt.show_full_path),
+                             graph.display(c, opt.show_full_path));
             }
+        }
+        out.println("}}");
+    }
+    else if (opt.show_unused)
+    {
+        print_unused(out, graph, opt.show_full_path, opt.no_header, opt.use_color);
+    }
+    else if (opt.show_interpose)
+    {
+        print_interpose(out, graph, opt.show_full_path, opt.no_header, opt.use_color);
+    }
+    else if (opt.show_footprint)
+    {
+        print_footprint(out, graph, opt.show_full_path, opt.no_header, opt.use_color);
+    }
+    else if (opt.show_cost)
+    {
+        print_cost(out, graph, opt.show_full_path, opt.no_header, opt.use_color);
+    }
+    else if (opt.show_dominators)
+    {
+        print_dominators(out, graph, opt.show_full_path, opt.no_header, opt.use_color);
+    }
+    else
+    {
+        size_t w = 0;
+        for (NodeId id = 0; id < graph.nodes.size(); ++id)
+        {
+            w = std::max(w, graph.display(id, opt.show_full_path).length());
+        }
+
+        bool show_pkgs = graph.cache->alpm.is_available() && !opt.no_pkg;
 
-            std::string origin = fs::path(cur_path).parent_path().string();
-            auto expand = [&](std::string& p)
+        std::string bold = opt.use_color ? "\033[1m" : "";
+        std::string reset = opt.use_color ? "\033[0m" : "";
+
+        if (!opt.no_header)
+        {
+            if (show_pkgs)
             {
-                size_t pos = 0;
-                while ((pos = p.find("$ORIGIN", pos)) != std::string::npos)
-                {
-                    p.replace(pos, 7, origin);
-                    pos += origin.length();
-                }
-            };
-            for (auto& p : my_rpaths) expand(p);
-            for (auto& p : my_runpaths) expand(p);
+                out.println("{}{:<{}}  {:<16} {:<6} {}{}", bold, "Library", w + 2, "Package", "Depth", "Required By",
+                             reset);
+            }
+            else
+            {
+                out.println("{}{:<{}}  {:<6} {}{}", bold, "Library", w + 2, "Depth", "Required By", reset);
+            }
+        }
 
-            std::vector<std::string> next_inherited;
-            if (my_runpaths.empty())
+        std::vector<NodeId> sorted_ids(graph.nodes.size());
+        std::iota(sorted_ids.begin(), sorted_ids.end(), NodeId{0});
+        r::sort(sorted_ids, {}, [&](NodeId id) -> const std::string& { return graph.name(id); });
+
+        for (const auto id : sorted_ids)
+        {
+            const auto& n = graph.nodes[id];
+            const auto node_parents = graph.parents[id];
+            std::string parent = "-";
+            if (!node_parents.empty())
             {
-                next_inherited = my_rpaths;
-                next_inherited.append_range(inherited);
+                parent = graph.display(node_parents[0], opt.show_full_path);
+                if (node_parents.size() > 1) parent += " (+)";
             }
 
-            for (const auto& lib : v::reverse(needed))
+            const auto& display_name = graph.display(id, opt.show_full_path);
+
+            if (show_pkgs)
             {
-                if (r::any_of(NOISE_PREFIX, [&](const auto& p) { return lib.starts_with(p); })) continue;
-                if (!show_stdlib && r::any_of(GLIBC_PREFIX, [&](const auto& p) { return lib.starts_with(p); }))
-                    continue;
+                std::string pkg_str = n.pkg.empty() ? "-" : n.pkg;
+                out.println("{:<{}}  {:<16} {:<6} {}", display_name, w + 2, pkg_str.substr(0, 14), n.depth, parent);
+            }
+            else
+            {
+                out.println("{:<{}}  {:<6} {}", display_name, w + 2, n.depth, parent);
+            }
+        }
+    }
 
-                if (r::find(nodes[cur].children, lib) == nodes[cur].children.end())
-                {
-                    nodes[cur].children.push_back(lib);
-                }
+    return 0;
+}
+
+// Expands batch inputs: directories are scanned recursively for ELF files, "-" reads one path
+// per line from stdin. Paths reaching the same file are only analyzed once.
+std::vector<std::string> collect_targets(const std::vector<std::string>& inputs)
+{
+    std::vector<std::string> targets;
+    std::unordered_set<std::string> seen;
+
+    auto add = [&](const fs::path& p)
+    {
+        if (Sysroot::archived())
+        {
+            const auto canonical = Sysroot::canonical(p.string());
+            if (!canonical)
+            {
+                std::println(std::cerr, "Warning: {}: No such file or directory", p.string());
+                return;
             }
-            r::reverse(nodes[cur].children);
+            if (seen.insert(*canonical).second) targets.push_back(p.string());
+            return;
+        }
+        std::error_code ec;
+        const auto canonical = fs::canonical(p, ec);
+        if (ec)
+        {
+            std::println(std::cerr, "Warning: {}: {}", p.string(), ec.message());
+            return;
+        }
+        if (seen.insert(canonical.string()).second) targets.push_back(fs::absolute(p).string());
+    };
 
-            for (const auto& lib : v::reverse(nodes[cur].children))
+    for (const auto& in : inputs)
+    {
+        if (in == "-")
+        {
+            std::string line;
+            while (std::getline(std::cin, line))
+            {
+                if (!line.empty()) add(Sysroot::locate(line));
+            }
+        }
+        else if (Sysroot::archived() && Sysroot::is_directory(in))
+        {
+            for (const auto& p : Sysroot::elf_files(in)) add(p);
+        }
+        else if (fs::is_directory(in))
+        {
+            std::vector<fs::path> found;
+            std::error_code ec;
+            for (auto it = fs::recursive_directory_iterator(in, fs::directory_options::skip_permission_denied, ec);
+                 it != fs::recursive_directory_iterator(); it.increment(ec))
             {
-                if (!nodes.contains(lib))
+                // A subdirectory that fails to open ends the whole iteration, so each one is tried
+                // first and skipped with a warning; denied ones are skipped by the iterator.
+                if (it->is_directory(ec) && !it->is_symlink(ec))
                 {
-                    nodes[lib] = {"", "", nodes[cur].depth + 1, {}, {}};
-                    nodes[lib].parents.push_back(cur);
-
-                    if (auto res = resolve_library(lib, my_rpaths, my_runpaths, inherited))
+                    const int fd = ::open(it->path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                    if (fd != -1) close(fd);
+                    else if (errno != EACCES && errno != EPERM)
                     {
-                        nodes[lib].path = *res;
-                        stack.push_back({lib, next_inherited});
+                        std::println(std::cerr, "Warning: {}: {}", it->path().string(), std::strerror(errno));
+                        it.disable_recursion_pending();
                     }
+                    continue;
                 }
-                else
+                if (it->is_regular_file(ec) && !it->is_symlink(ec) && is_elf_file(it->path()))
                 {
-                    if (r::find(nodes[lib].parents, cur) == nodes[lib].parents.end())
-                    {
-                        nodes[lib].parents.push_back(cur);
-                    }
+                    found.push_back(it->path());
                 }
             }
+            if (ec) std::println(std::cerr, "Warning: {}: {}", in, ec.message());
+            r::sort(found);
+            for (const auto& p : found) add(p);
         }
-
-        if (resolve_packages)
+        else
         {
-            std::vector<std::string> all_paths;
-            for (const auto& n : nodes | std::views::values)
-            {
-                if (!n.path.empty()) all_paths.push_back(n.path);
-            }
-            alpm.batch_resolve(all_paths);
-            for (auto& n : nodes | std::views::values)
-            {
-                if (!n.path.empty()) n.pkg = alpm.get_package(n.path);
-            }
+            add(in);
         }
     }
+    return targets;
+}
+
+// Analyzes many binaries against one LibraryCache: every distinct library is parsed once. Binaries
+// go through in chunks of BATCH_CHUNK: built, packages resolved in one batch_resolve pass, printed
+// and dropped before the next chunk starts, so memory stays bounded however many are scanned.
+int run_batch(const std::vector<std::string>& inputs, const OutputOptions& opt, bool show_stdlib, size_t jobs,
+              const std::shared_ptr<LibraryCache>& shared)
+{
+    constexpr size_t BATCH_CHUNK = 64;
+    const auto targets = collect_targets(inputs);
+
+    if (opt.show_pkg_list && !shared->alpm.is_available())
+    {
+        std::println(std::cerr, "Error: libalpm not loaded. Cannot resolve packages.");
+        return 1;
+    }
 
-    std::vector<std::string> get_minimal_pkgs()
+    OutputWriter out;
+    int rc = 0;
+    for (size_t first = 0; first < targets.size(); first += BATCH_CHUNK)
     {
-        std::unordered_map<std::string, std::string> lib_to_pkg;
-        std::string root_pkg_name;
+        const auto chunk = std::span(targets).subspan(first, std::min(BATCH_CHUNK, targets.size() - first));
 
-        if (nodes.contains(root_name))
+        std::deque<DepGraph> graphs;
+        for (const auto& t : chunk) graphs.emplace_back(shared).prepare(t);
+
+        if (jobs > 1)
         {
-            root_pkg_name = nodes.at(root_name).pkg;
+            Stats::Scope scope(Stats::PREFETCH);
+            WorkStealingPool pool(jobs);
+            for (size_t i = 0; i < chunk.size(); ++i)
+            {
+                pool.submit([&, i] { graphs[i].prefetch(pool, chunk[i], {}, show_stdlib); });
+            }
+            pool.wait();
         }
-        bool has_root_pkg = !root_pkg_name.empty() && root_pkg_name != "-";
 
-        for (const auto& [l, n] : nodes)
         {
-            if (!n.pkg.empty() && n.pkg != "-") lib_to_pkg[l] = n.pkg;
+            Stats::Scope scope(Stats::WALK);
+            for (size_t i = 0; i < chunk.size(); ++i) graphs[i].walk(chunk[i], show_stdlib);
         }
 
-        std::unordered_map<std::string, std::unordered_set<std::string>> pkg_deps;
+        if (!opt.no_pkg)
+        {
+            std::vector<std::string> all_paths;
+            for (const auto& g : graphs) all_paths.append_range(g.resolved_paths());
+            shared->alpm.batch_resolve(all_paths);
+            for (auto& g : graphs) g.assign_packages();
+        }
 
-        for (const auto& [parent, node] : nodes)
+        for (size_t i = 0; i < chunk.size(); ++i)
         {
-            std::string p_pkg;
-            if (parent == root_name)
-            {
-                p_pkg = "__ROOT__";
-            }
-            else if (lib_to_pkg.contains(parent))
-            {
-                p_pkg = lib_to_pkg[parent];
-                if (has_root_pkg && p_pkg == root_pkg_name) p_pkg = "__ROOT__";
-            }
-            else
+            if (!opt.show_json && !opt.show_ndjson)
             {
-                continue;
+                out.println("{}==> {} <==", first + i == 0 ? "" : "\n", chunk[i]);
             }
+            rc |= print_graph(out, graphs.front(), opt);
+            graphs.pop_front();
+        }
+        out.flush();
+    }
+    shared->save_disk_cache();
+    return rc;
+}
 
-            for (const auto& child : node.children)
-            {
-                if (lib_to_pkg.contains(child))
-                {
-                    std::string c_pkg = lib_to_pkg[child];
-                    if (has_root_pkg && c_pkg == root_pkg_name) c_pkg = "__ROOT__";
+int run_single(const std::string& elf_path, const OutputOptions& opt, bool show_stdlib, size_t jobs,
+               const std::shared_ptr<LibraryCache>& shared)
+{
+    if (!Sysroot::exists(elf_path))
+    {
+        std::println(std::cerr, "Error: File not found.");
+        return 1;
+    }
 
-                    if (c_pkg != p_pkg) pkg_deps[p_pkg].insert(c_pkg);
-                }
-            }
-        }
+    DepGraph graph(shared);
+    graph.build(fs::absolute(elf_path).string(), show_stdlib, !opt.no_pkg, jobs);
+    graph.cache->save_disk_cache();
 
-        std::unordered_set<std::string> transitive;
-        for (const auto& [p, kids] : pkg_deps)
+    OutputWriter out;
+    return print_graph(out, graph, opt);
+}
+
+// --sysroot: analyzes the same image paths inside every root (a directory or tar layers) in turn,
+// each with its own lookups (ld.so.cache, directories, pacman DB). Parse results are shared
+// between the images by content.
+int run_sysroots(const std::vector<std::string>& roots, const std::vector<std::string>& inputs,
+                 const OutputOptions& opt, bool show_stdlib, size_t jobs, bool use_disk_cache)
+{
+    auto files = std::make_shared<FileResults>();
+    int rc = 0;
+    for (const auto& root : roots)
+    {
+        if (!Sysroot::enter(root))
         {
-            if (p != "__ROOT__") transitive.insert(kids.begin(), kids.end());
+            std::println(std::cerr, "Error: cannot open sysroot {}.", root);
+            rc = 1;
+            continue;
         }
 
-        std::vector<std::string> result;
-        if (pkg_deps.contains("__ROOT__"))
+        auto cache = roots.size() > 1 ? std::make_shared<LibraryCache>(files) : std::make_shared<LibraryCache>();
+        if (use_disk_cache) cache->open_disk_cache();
+
+        std::vector<std::string> targets;
+        for (const auto& in : inputs) targets.push_back(in == "-" ? in : Sysroot::locate(in));
+
+        const bool batch = roots.size() > 1 || targets.size() > 1 || r::any_of(targets, [](const std::string& p)
         {
-            for (const auto& p : pkg_deps["__ROOT__"])
-            {
-                if (!transitive.contains(p)) result.push_back(p);
-            }
+            return p == "-" || Sysroot::is_directory(p);
+        });
+        rc |= batch ? run_batch(targets, opt, show_stdlib, jobs, cache)
+                    : run_single(targets.front(), opt, show_stdlib, jobs, cache);
+    }
+    Sysroot::enter("");
+    return rc;
+}
+
+// Queries the reverse index for `lib`, refreshing it first if any indexed directory or file
+// changed. `dirs` replaces the default set of system directories.
+int run_rdeps(const std::string& lib, const std::vector<std::string>& dirs, const OutputOptions& opt, size_t jobs,
+              const std::shared_ptr<LibraryCache>& shared)
+{
+    static const std::vector<std::string> DEFAULT_DIRS = {
+        "/usr/bin", "/usr/sbin", "/usr/lib", "/usr/lib64", "/usr/libexec", "/usr/local/bin", "/usr/local/lib",
+        "/bin", "/sbin", "/lib", "/lib64", "/opt"
+    };
+
+    std::vector<std::string> roots;
+    for (const auto& d : dirs.empty() ? DEFAULT_DIRS : dirs)
+    {
+        std::error_code ec;
+        auto canonical = fs::canonical(d, ec);
+        if (!ec && fs::is_directory(canonical, ec)) roots.push_back(canonical.string());
+        else if (!dirs.empty()) std::println(std::cerr, "Error: {} is not a directory.", d);
+    }
+    r::sort(roots);
+    roots.erase(r::unique(roots).begin(), roots.end());
+    if (roots.empty()) return 1;
+
+    std::string key;
+    for (const auto& root : roots) key += root + '\n';
+
+    ReverseIndex index(ReverseIndex::default_path());
+    if (!index.fresh(key))
+    {
+        DepGraph resolver(shared);
+        index.rebuild(roots, key, resolver, jobs);
+        shared->save_disk_cache();
+    }
+
+    std::string target = lib;
+    if (lib.contains('/'))
+    {
+        std::error_code ec;
+        if (auto canonical = fs::canonical(lib, ec); !ec) target = canonical.string();
+    }
+
+    OutputWriter out;
+    Stats::Scope scope(Stats::OUTPUT);
+    return print_rdeps(out, index, target, opt.no_header, opt.use_color);
+}
+
+// Compares two binaries, or saved --json output of them. Binaries are built on one cache, so the
+// libraries they share are parsed once. Exits like diff(1): 0 when they match, 1 when they
+// differ, 2 on trouble.
+int run_diff(const std::vector<std::string>& inputs, const OutputOptions& opt, bool show_stdlib, size_t jobs,
+             const std::shared_ptr<LibraryCache>& shared)
+{
+    std::vector<GraphSnapshot> snaps;
+    for (const auto& in : inputs)
+    {
+        if (!fs::exists(in))
+        {
+            std::println(std::cerr, "Error: {}: File not found.", in);
+            return 2;
         }
-        r::sort(result);
-        return result;
+        if (!is_elf_file(in))
+        {
+            auto snap = GraphSnapshot::from_json(in);
+            if (!snap) return 2;
+            snaps.push_back(std::move(*snap));
+            continue;
+        }
+        DepGraph graph(shared);
+        graph.build(fs::absolute(in).string(), show_stdlib, !opt.no_pkg, jobs);
+        snaps.push_back(GraphSnapshot::from_graph(graph));
+    }
+    shared->save_disk_cache();
+
+    OutputWriter out;
+    Stats::Scope scope(Stats::OUTPUT);
+    return print_snapshot_diff(out, snaps[0], snaps[1], opt.show_json, opt.no_header, opt.use_color) ? 1 : 0;
+}
+
+int run_cli(int argc, char** argv, std::shared_ptr<LibraryCache> shared = nullptr);
+
+// The socket lives in a directory only this user can enter: $XDG_RUNTIME_DIR/inspect-deps, or
+// /tmp/inspect-deps-<uid>. A directory that is a symlink, belongs to someone else or is open to
+// others is refused, so nobody else can put a socket where a client would connect.
+std::optional<std::string> daemon_socket_path(bool create)
+{
+    const char* runtime = std::getenv("XDG_RUNTIME_DIR");
+    const fs::path dir = runtime && *runtime ? fs::path(runtime) / "inspect-deps"
+                                             : fs::path(std::format("/tmp/inspect-deps-{}", getuid()));
+
+    if (create && mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) return std::nullopt;
+    struct stat st{};
+    if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 0077) != 0)
+        return std::nullopt;
+    return (dir / "daemon.sock").string();
+}
+
+// Whether the process at the other end of a connected socket runs as this user.
+bool peer_is_self(int fd)
+{
+    ucred cred{};
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+}
+
+bool write_all(int fd, const void* data, size_t size)
+{
+    const auto* p = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        const ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool read_all(int fd, void* data, size_t size)
+{
+    auto* p = static_cast<char*>(data);
+    while (size > 0)
+    {
+        const ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Connects only to a socket we own that is served by a process of ours.
+std::optional<int> connect_unix(const std::string& path)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return std::nullopt;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    struct stat st{};
+    if (lstat(path.c_str(), &st) != 0 || !S_ISSOCK(st.st_mode) || st.st_uid != getuid()) return std::nullopt;
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return std::nullopt;
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == -1 || !peer_is_self(fd))
+    {
+        close(fd);
+        return std::nullopt;
+    }
+    return fd;
+}
+
+// Request: a u32 payload size sent together with our stdin/stdout/stderr (SCM_RIGHTS), then the
+// payload: u32 count followed by length-prefixed strings (cwd, LD_LIBRARY_PATH flag and value,
+// argv). Reply: the i32 exit status. Output goes straight to the passed descriptors.
+std::optional<int> forward_to_daemon(int argc, char** argv)
+{
+    const auto path = daemon_socket_path(false);
+    if (!path) return std::nullopt;
+    const auto fd = connect_unix(*path);
+    if (!fd) return std::nullopt;
+
+    std::vector<std::string> fields;
+    std::error_code ec;
+    fields.push_back(fs::current_path(ec).string());
+    const char* ld = std::getenv("LD_LIBRARY_PATH");
+    fields.emplace_back(ld ? "1" : "0");
+    fields.emplace_back(ld ? ld : "");
+    for (int i = 0; i < argc; ++i) fields.emplace_back(argv[i]);
+
+    std::string payload;
+    auto put_u32 = [&](uint32_t v) { payload.append(reinterpret_cast<const char*>(&v), sizeof(v)); };
+    put_u32(static_cast<uint32_t>(fields.size()));
+    for (const auto& f : fields)
+    {
+        put_u32(static_cast<uint32_t>(f.size()));
+        payload += f;
+    }
+
+    uint32_t size = payload.size();
+    iovec iov{&size, sizeof(size)};
+    alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))]{};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    const int stdio[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    std::memcpy(CMSG_DATA(cmsg), stdio, sizeof(stdio));
+
+    int32_t rc = 1;
+    const bool ok = sendmsg(*fd, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(size)) &&
+                    write_all(*fd, payload.data(), payload.size()) && read_all(*fd, &rc, sizeof(rc));
+    close(*fd);
+    if (!ok)
+    {
+        std::println(std::cerr, "Error: lost connection to inspect-deps daemon.");
+        return 1;
     }
-};
+    return rc;
+}
 
-struct JsonOutput
+// Directory watches on one inotify descriptor. A directory reached under several names (/lib
+// and /usr/lib) gets one watch that reports every name. A directory that does not exist yet is
+// waited for on its nearest existing ancestor and watched itself once it appears.
+class DirectoryWatcher
 {
-    std::string root;
-    std::map<std::string, std::map<std::string, std::string>> dependencies;
-    std::vector<std::string> minimal_packages;
-};
+    static constexpr uint32_t MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM |
+        IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
 
-void print_tree(const DepGraph& g, const std::string& root, const bool show_pkgs, const bool use_color, bool full_path)
-{
-    std::string gray = use_color ? "\033[90m" : "";
-    std::string reset = use_color ? "\033[0m" : "";
+    int fd = -1;
+    std::unordered_map<int, std::vector<std::string>> watches;
+    std::unordered_map<int, std::vector<std::string>> waiting;
+    std::unordered_set<std::string> watched;
 
-    std::unordered_set<std::string> seen;
-    auto rec = [&](auto&& self, const std::string& n, std::string pref, const bool last,
-                   std::unordered_set<std::string>& path) -> void
+    // Watches dir, or failing that its nearest existing ancestor. True if dir itself is watched.
+    bool add(const std::string& dir)
     {
-        const auto& node = g.nodes.at(n);
-        std::string display_name = (full_path && !node.path.empty()) ? node.path : n;
-        std::print("{}{} {}", pref, (last ? "└── " : "├── "), display_name);
-
-        if (show_pkgs)
+        int wd = inotify_add_watch(fd, dir.c_str(), MASK);
+        if (wd != -1)
         {
-            std::print(" {}[{}]", gray, (node.pkg.empty() ? "-" : node.pkg));
-            if (use_color) std::print("{}", reset);
+            watched.insert(dir);
+            watches[wd].push_back(dir);
+            return true;
         }
+        if (errno != ENOENT || !dir.starts_with('/')) return false;
 
-        if (path.contains(n))
+        for (fs::path p = fs::path(dir).parent_path(); wd == -1; p = p.parent_path())
         {
-            std::println(" (cycle)");
-            return;
+            wd = inotify_add_watch(fd, p.c_str(), MASK);
+            if (wd == -1 && (errno != ENOENT || p == p.root_path())) return false;
         }
+        watched.insert(dir);
+        waiting[wd].push_back(dir);
+        return false;
+    }
 
-        if (seen.contains(n))
+    // Something under a waited-on ancestor was created, moved in or went away: look again for
+    // each directory waited for there. One that now exists is reported as changed.
+    void recheck(int wd, const std::function<void(const std::string&, std::string_view)>& on_change)
+    {
+        const auto node = waiting.extract(wd);
+        if (node.empty()) return;
+        for (const auto& d : node.mapped())
         {
-            std::println(" (+)");
-            return;
+            watched.erase(d);
+            if (add(d)) on_change(d, "");
         }
-        std::println("");
-
-        seen.insert(n);
-        path.insert(n);
+        if (!waiting.contains(wd) && !watches.contains(wd)) inotify_rm_watch(fd, wd);
+    }
 
-        size_t i = 0;
-        std::vector<std::string> sorted_children = node.children;
-        r::sort(sorted_children);
+public:
+    DirectoryWatcher() : fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) {}
 
-        for (const auto& child : sorted_children)
-        {
-            self(self, child, pref + (last ? "    " : "│   "), i == sorted_children.size() - 1, path);
-            i++;
-        }
-        path.erase(n);
-    };
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
 
-    const auto& root_node = g.nodes.at(root);
-    std::string root_display = (full_path && !root_node.path.empty()) ? root_node.path : root;
-    std::print("{}", root_display);
-    if (show_pkgs)
+    ~DirectoryWatcher()
     {
-        std::print(" {}[{}]", gray, (root_node.pkg.empty() ? "-" : root_node.pkg));
-        if (use_color) std::print("{}", reset);
+        if (fd != -1) close(fd);
     }
-    std::println("");
 
-    std::unordered_set<std::string> path;
-    path.insert(root);
-    seen.insert(root);
+    int descriptor() const { return fd; }
 
-    size_t i = 0;
-    std::vector<std::string> sorted_children = root_node.children;
-    r::sort(sorted_children);
-    for (const auto& child : sorted_children)
+    void watch(const std::string& dir)
     {
-        rec(rec, child, "", i == sorted_children.size() - 1, path);
-        i++;
+        if (fd == -1 || watched.contains(dir)) return;
+        add(dir);
     }
-}
 
-void explain_why(const DepGraph& g, const std::string& target_in, bool full_path)
-{
-    std::string target = target_in;
-    if (!g.nodes.contains(target))
+    // Reads every pending event and calls on_change(dir, entry) for each name of the directory;
+    // entry is empty when the directory itself went away or appeared. False if the kernel
+    // dropped events.
+    bool drain(const std::function<void(const std::string&, std::string_view)>& on_change)
     {
-        bool found = false;
-        // 1. Try matching full path
-        for (const auto& [k, n] : g.nodes)
+        bool complete = true;
+        alignas(inotify_event) char buf[64 * 1024];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
         {
-            if (n.path == target)
+            for (ssize_t off = 0; off < n;)
             {
-                target = k;
-                found = true;
-                break;
-            }
-        }
+                const auto* ev = reinterpret_cast<const inotify_event*>(buf + off);
+                off += sizeof(inotify_event) + ev->len;
 
-        // 2. Try matching canonical path
-        if (!found && fs::exists(target_in))
-        {
-            std::error_code ec;
-            std::string canonical = fs::canonical(target_in, ec).string();
-            if (!ec)
-            {
-                for (const auto& [k, n] : g.nodes)
+                if (ev->mask & IN_Q_OVERFLOW)
+                {
+                    complete = false;
+                    continue;
+                }
+
+                if (waiting.contains(ev->wd) &&
+                    ev->mask & (IN_CREATE | IN_MOVED_TO | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+                {
+                    recheck(ev->wd, on_change);
+                }
+
+                const auto it = watches.find(ev->wd);
+                if (it == watches.end()) continue;
+
+                if (ev->mask & IN_IGNORED)
                 {
-                    if (n.path == canonical)
+                    for (const auto& d : it->second)
                     {
-                        target = k;
-                        found = true;
-                        break;
+                        watched.erase(d);
+                        on_change(d, "");
                     }
+                    watches.erase(it);
+                    continue;
                 }
+
+                const std::string_view name = ev->len ? ev->name : "";
+                for (const auto& d : it->second) on_change(d, name);
             }
         }
+        return complete;
+    }
+};
+
+// --serve: keeps one LibraryCache warm and answers forwarded command lines one at a time.
+// Directories holding parsed files and listed search paths are watched with inotify; a change
+// drops the affected entries, and a new ld.so.cache or pacman DB resets the whole cache.
+class Daemon
+{
+    std::shared_ptr<LibraryCache> cache;
+    bool use_disk_cache;
+    DirectoryWatcher watcher;
+    const std::string pacman_local = std::format("{}/local", AlpmManager::DB_PATH);
 
-        // 3. Try matching filename
-        if (!found)
+    static constexpr time_t CLIENT_TIMEOUT_SEC = 5;
+
+    inline static volatile sig_atomic_t stop_requested = 0;
+
+    void reset()
+    {
+        cache = std::make_shared<LibraryCache>();
+        if (use_disk_cache) cache->open_disk_cache();
+    }
+
+    void watch_known_paths()
+    {
+        watcher.watch("/etc");
+        watcher.watch(pacman_local);
+        std::unordered_set<std::string> dirs;
+        cache->identities.for_each([&](const std::string& path, const auto&)
         {
-            std::string fname = fs::path(target_in).filename().string();
-            if (g.nodes.contains(fname))
-            {
-                target = fname;
-                found = true;
-            }
-        }
+            dirs.insert(fs::path(path).parent_path().string());
+        });
+        for (const auto& d : cache->dirs.listed_dirs()) dirs.insert(d);
+        for (const auto& d : dirs) watcher.watch(d);
+    }
 
-        if (!found)
+    void drain_events()
+    {
+        bool full_reset = false;
+        std::unordered_set<std::string> changed;
+        const bool complete = watcher.drain([&](const std::string& dir, std::string_view name)
         {
-            std::println(std::cerr, "Library {} not found in dependency graph.", target_in);
-            return;
-        }
+            if (dir == "/etc") full_reset |= name == "ld.so.cache";
+            else if (dir == pacman_local) full_reset = true;
+            else changed.insert(dir);
+        });
+
+        if (full_reset || !complete) reset();
+        else if (!changed.empty()) cache->invalidate(changed);
     }
 
-    auto dfs = [&](auto&& self, const std::string& cur, std::vector<std::string>& path) -> void
+    int32_t handle(int client)
     {
-        if (cur == g.root_name)
+        uint32_t size = 0;
+        iovec iov{&size, sizeof(size)};
+        alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))]{};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(client, &msg, MSG_CMSG_CLOEXEC) != static_cast<ssize_t>(sizeof(size))) return 1;
+
+        const cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))) return 1;
+        int fds[3];
+        std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+        std::string payload(size, '\0');
+        std::vector<std::string> fields;
+        if (read_all(client, payload.data(), payload.size()))
         {
-            path.push_back(cur);
-            for (const auto& p : v::reverse(path))
+            std::string_view rest = payload;
+            auto get_u32 = [&]() -> std::optional<uint32_t>
+            {
+                if (rest.size() < sizeof(uint32_t)) return std::nullopt;
+                uint32_t v;
+                std::memcpy(&v, rest.data(), sizeof(v));
+                rest.remove_prefix(sizeof(v));
+                return v;
+            };
+            auto count = get_u32();
+            for (uint32_t i = 0; count && i < *count; ++i)
             {
-                std::string display_name = (full_path && !g.nodes.at(p).path.empty()) ? g.nodes.at(p).path : p;
-                std::print("{} -> ", display_name);
+                auto len = get_u32();
+                if (!len || *len > rest.size()) break;
+                fields.emplace_back(rest.substr(0, *len));
+                rest.remove_prefix(*len);
             }
-            std::string target_display = (full_path && !g.nodes.at(target).path.empty())
-                                             ? g.nodes.at(target).path
-                                             : target;
-            std::println("{}", target_display);
-            path.pop_back();
-            return;
+        }
+        if (fields.size() < 4)
+        {
+            for (const int fd : fds) close(fd);
+            return 1;
         }
 
-        path.push_back(cur);
-        for (const auto& p : g.nodes.at(cur).parents)
+        const int saved_cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        const char* old_ld = std::getenv("LD_LIBRARY_PATH");
+        const std::optional<std::string> saved_ld = old_ld ? std::optional<std::string>(old_ld) : std::nullopt;
+
+        int32_t rc = 1;
+        if (chdir(fields[0].c_str()) == 0)
         {
-            if (r::find(path, p) == path.end())
+            if (fields[1] == "1") setenv("LD_LIBRARY_PATH", fields[2].c_str(), 1);
+            else unsetenv("LD_LIBRARY_PATH");
+
+            std::fflush(stdout);
+            int saved[3];
+            for (int i = 0; i < 3; ++i)
             {
-                self(self, p, path);
+                saved[i] = dup(i);
+                dup2(fds[i], i);
+            }
+            __fpurge(stdin);
+            clearerr(stdin);
+            std::cin.clear();
+
+            std::vector<char*> args;
+            for (auto& f : fields | v::drop(3)) args.push_back(f.data());
+            args.push_back(nullptr);
+            try
+            {
+                rc = run_cli(static_cast<int>(args.size() - 1), args.data(), cache);
+            }
+            catch (const std::exception& e)
+            {
+                std::println(std::cerr, "Error: {}", e.what());
             }
-        }
-        path.pop_back();
-    };
 
-    std::vector<std::string> path;
-    for (const auto& p : g.nodes.at(target).parents)
-    {
-        dfs(dfs, p, path);
-    }
-}
+            std::cout.flush();
+            std::fflush(stdout);
+            std::fflush(stderr);
+            for (int i = 0; i < 3; ++i)
+            {
+                dup2(saved[i], i);
+                close(saved[i]);
+            }
+        }
+        for (const int fd : fds) close(fd);
 
-void generate_completions(const CLI::App& app, const std::string& shell)
-{
-    std::vector<const CLI::Option*> all_options = app.get_options();
-    for (const auto* group : app.get_subcommands([](const CLI::App*) { return true; }))
-    {
-        for (const auto* opt : group->get_options())
+        if (saved_cwd != -1)
         {
-            all_options.push_back(opt);
+            if (fchdir(saved_cwd) != 0) std::println(std::cerr, "Warning: cannot restore working directory");
+            close(saved_cwd);
         }
+        if (saved_ld) setenv("LD_LIBRARY_PATH", saved_ld->c_str(), 1);
+        else unsetenv("LD_LIBRARY_PATH");
+
+        return rc;
     }
 
-    if (shell == "fish")
+public:
+    explicit Daemon(bool disk_cache) : use_disk_cache(disk_cache) {}
+
+    int run()
     {
-        std::println("# fish completion for inspect-deps");
+        const auto socket_path = daemon_socket_path(true);
+        if (!socket_path)
+        {
+            std::println(std::cerr, "Error: no private directory for the daemon socket.");
+            return 1;
+        }
+        const auto& path = *socket_path;
+        if (auto existing = connect_unix(path))
+        {
+            close(*existing);
+            std::println(std::cerr, "Error: a daemon is already listening on {}", path);
+            return 1;
+        }
+        unlink(path.c_str());
 
-        for (const auto* opt : all_options)
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
         {
-            if (opt->get_name().empty()) continue;
+            std::println(std::cerr, "Error: socket path too long: {}", path);
+            return 1;
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+        const int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const mode_t old_umask = umask(0077);
+        const bool bound = listen_fd != -1 &&
+            bind(listen_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0 &&
+            listen(listen_fd, 64) == 0;
+        umask(old_umask);
+        if (!bound)
+        {
+            std::println(std::cerr, "Error: cannot listen on {}: {}", path, std::strerror(errno));
+            if (listen_fd != -1) close(listen_fd);
+            return 1;
+        }
 
-            std::string short_opt;
-            std::string long_opt;
+        reset();
+        watch_known_paths();
 
-            for (const auto& name : opt->get_snames()) short_opt = name;
-            for (const auto& name : opt->get_lnames()) long_opt = name;
+        struct sigaction sa{};
+        sa.sa_handler = [](int) { stop_requested = 1; };
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGTERM, &sa, nullptr);
+        signal(SIGPIPE, SIG_IGN);
 
-            if (short_opt.empty() && long_opt.empty()) continue;
+        std::println(std::cerr, "inspect-deps: serving on {}", path);
+        while (!stop_requested)
+        {
+            const int inotify_fd = watcher.descriptor();
+            pollfd pfds[2] = {{listen_fd, POLLIN, 0}, {inotify_fd, POLLIN, 0}};
+            if (poll(pfds, inotify_fd == -1 ? 1 : 2, -1) == -1) continue;
 
-            std::print("complete -c inspect-deps");
-            if (!short_opt.empty()) std::print(" -s {}", short_opt);
-            if (!long_opt.empty()) std::print(" -l {}", long_opt);
-            std::print(" -d \"{}\"", opt->get_description());
+            if (inotify_fd != -1 && (pfds[1].revents & POLLIN)) drain_events();
+            if (!(pfds[0].revents & POLLIN)) continue;
 
-            if (long_opt == "completions")
+            const int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client == -1) continue;
+            // Descriptors and command lines are only taken from our own processes.
+            if (!peer_is_self(client))
             {
-                std::print(" -a \"bash zsh fish\"");
-            }
-            else if (opt->get_expected() > 0)
-            {
-                std::print(" -r");
+                close(client);
+                continue;
             }
-
-            std::println("");
+            // A client that stops sending (or reading its status) must not hold up the others.
+            const timeval timeout{CLIENT_TIMEOUT_SEC, 0};
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+            if (inotify_fd != -1) drain_events();
+            cache->dirs.forget_missing();
+            const int32_t rc = handle(client);
+            write_all(client, &rc, sizeof(rc));
+            close(client);
+            watch_known_paths();
         }
 
-        std::println("complete -c inspect-deps -a \"(__fish_complete_path)\"");
+        close(listen_fd);
+        unlink(path.c_str());
+        return 0;
     }
-    else if (shell == "zsh")
+};
+
+// --watch: keeps the graphs of the targets and rebuilds one when a directory holding a file it
+// loads or searches for a library changes. The LibraryCache stays, minus what came from changed
+// directories, so only the files that changed are parsed again. A new ld.so.cache or pacman DB
+// starts a fresh cache (keeping parse results) and rebuilds every graph. Each rebuild prints an
+// NDJSON "diff" record; the first build of every target reports its whole graph.
+class Watcher
+{
+    struct Target
     {
-        std::println("#compdef inspect-deps=inspect-deps");
-        std::println("_arguments -s \\");
+        std::string path;
+        DepGraph graph;
+        std::unordered_set<std::string> dirs;
+    };
 
-        for (const auto* opt : all_options)
-        {
-            if (opt->get_name().empty()) continue;
+    // Writes of one link step arrive as a burst; rebuild once it has been quiet this long.
+    static constexpr int SETTLE_MS = 100;
 
-            std::string short_opt;
-            std::string long_opt;
-            for (const auto& name : opt->get_snames()) short_opt = name;
-            for (const auto& name : opt->get_lnames()) long_opt = name;
+    std::shared_ptr<LibraryCache> cache;
+    const OutputOptions& opt;
+    bool show_stdlib;
+    size_t jobs;
+    bool use_disk_cache;
+    DirectoryWatcher watcher;
+    std::vector<Target> targets;
+    OutputWriter out;
+    const std::string pacman_local = std::format("{}/local", AlpmManager::DB_PATH);
 
-            if (short_opt.empty() && long_opt.empty()) continue;
+    inline static volatile sig_atomic_t stop_requested = 0;
 
-            std::print("    '");
-            if (!short_opt.empty()) std::print("-{}", short_opt);
-            if (!long_opt.empty())
+    // Directories whose contents decide the graph: those of its files, and every directory
+    // resolve_library() may have listed for it.
+    std::unordered_set<std::string> dependency_dirs(DepGraph& g)
+    {
+        std::unordered_set<std::string> dirs(g.ld_paths.begin(), g.ld_paths.end());
+        for (const auto dir : {"/lib", "/usr/lib", "/lib64", "/usr/lib64"}) dirs.insert(dir);
+        for (const auto& n : g.nodes)
+        {
+            if (n.path.empty()) continue;
+            dirs.insert(fs::path(n.path).parent_path().string());
+            if (const auto dyn = g.load_dynamic(n.path))
             {
-                if (!short_opt.empty()) std::print(",");
-                std::print("--{}", long_opt);
-                if (opt->get_expected() > 0) std::print("=");
+                const auto ex = DepGraph::expand(n.path, *dyn, {}, show_stdlib);
+                dirs.insert(ex.rpaths.begin(), ex.rpaths.end());
+                dirs.insert(ex.runpaths.begin(), ex.runpaths.end());
             }
+        }
+        return dirs;
+    }
 
-            std::print("[{}]", opt->get_description());
+    void rebuild(Target& t)
+    {
+        DepGraph graph(cache);
+        graph.build(t.path, show_stdlib, !opt.no_pkg, jobs);
+        print_graph_diff(out, t.graph.nodes.empty() ? nullptr : &t.graph, graph);
+        t.graph = std::move(graph);
+        t.dirs = dependency_dirs(t.graph);
+        for (const auto& d : t.dirs) watcher.watch(d);
+    }
 
-            if (long_opt == "completions")
-            {
-                std::print(":completion:(bash zsh fish)");
-            }
-            else if (opt->get_expected() > 0)
+    void drain_events()
+    {
+        bool full_reset = false;
+        bool complete = true;
+        std::unordered_set<std::string> changed;
+        pollfd pfd{watcher.descriptor(), POLLIN, 0};
+        do
+        {
+            complete &= watcher.drain([&](const std::string& dir, std::string_view name)
             {
-                std::print(":file:_files");
-            }
-            std::println("' \\");
+                if (dir == "/etc") full_reset |= name == "ld.so.cache";
+                else if (dir == pacman_local) full_reset = true;
+                else changed.insert(dir);
+            });
+        } while (!stop_requested && poll(&pfd, 1, SETTLE_MS) > 0);
+        if (complete && !full_reset && changed.empty()) return;
+
+        cache->invalidate(changed);
+        if (full_reset || !complete)
+        {
+            auto fresh = std::make_shared<LibraryCache>();
+            if (use_disk_cache) fresh->open_disk_cache();
+            if (complete) fresh->files = cache->files;
+            cache = std::move(fresh);
         }
-        std::println("    '*:elf file:_files'");
-    }
-    else if (shell == "bash")
-    {
-        std::println("# bash completion for inspect-deps");
-        std::println("_inspect_deps() {{");
-        std::println("    local cur prev opts");
-        std::println("    COMPREPLY=()");
-        std::println("    cur=\"${{COMP_WORDS[COMP_CWORD]}}\"");
-        std::println("    prev=\"${{COMP_WORDS[COMP_CWORD-1]}}\"");
 
-        std::print("    opts=\"");
-        for (const auto* opt : all_options)
+        for (auto& t : targets)
         {
-            for (const auto& name : opt->get_snames()) std::print("-{} ", name);
-            for (const auto& name : opt->get_lnames()) std::print("--{} ", name);
+            if (full_reset || !complete || r::any_of(changed, [&](const auto& d) { return t.dirs.contains(d); }))
+                rebuild(t);
         }
-        std::println("\"");
+        cache->save_disk_cache();
+    }
 
-        std::println("    if [[ ${{prev}} == \"--completions\" ]]; then");
-        std::println("        COMPREPLY=( $(compgen -W \"bash zsh fish\" -- ${{cur}}) )");
-        std::println("        return 0");
-        std::println("    fi");
+public:
+    Watcher(const OutputOptions& opt, bool show_stdlib, size_t jobs, bool use_disk_cache,
+            std::shared_ptr<LibraryCache> shared)
+        : cache(std::move(shared)), opt(opt), show_stdlib(show_stdlib), jobs(jobs), use_disk_cache(use_disk_cache)
+    {
+    }
 
-        std::println("    if [[ ${{cur}} == -* ]]; then");
-        std::println("        COMPREPLY=( $(compgen -W \"${{opts}}\" -- ${{cur}}) )");
-        std::println("        return 0");
-        std::println("    fi");
-        std::println("    COMPREPLY=( $(compgen -f -- ${{cur}}) )");
-        std::println("}}");
-        std::println("complete -F _inspect_deps inspect-deps");
+    int run(const std::vector<std::string>& inputs)
+    {
+        if (watcher.descriptor() == -1)
+        {
+            std::println(std::cerr, "Error: cannot watch for changes: {}", std::strerror(errno));
+            return 1;
+        }
+        watcher.watch("/etc");
+        watcher.watch(pacman_local);
+        for (const auto& path : collect_targets(inputs)) targets.push_back({path, DepGraph(cache), {}});
+        for (auto& t : targets) rebuild(t);
+        cache->save_disk_cache();
+
+        struct sigaction sa{};
+        sa.sa_handler = [](int) { stop_requested = 1; };
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGTERM, &sa, nullptr);
+
+        while (!stop_requested)
+        {
+            pollfd pfd{watcher.descriptor(), POLLIN, 0};
+            if (poll(&pfd, 1, -1) > 0 && (pfd.revents & POLLIN)) drain_events();
+        }
+        return 0;
     }
-}
+};
 
-int main(int argc, char** argv)
+// Parses one command line and runs it. `shared` is the resident cache when called by --serve.
+int run_cli(int argc, char** argv, std::shared_ptr<LibraryCache> shared)
 {
     CLI::App app{"inspect-deps: Static ELF dependency analyzer"};
     app.footer(
         "\nTree output markers:\n  (+)     Repeated node (diamond), not expanded\n  (cycle) Circular dependency");
 
-    std::string elf_path;
-    app.add_option("elf", elf_path, "Target binary");
+    std::vector<std::string> elf_paths;
+    app.add_option("elf", elf_paths, "Target binary (several files, directories, or - for a list on stdin)");
 
-    bool show_tree = false;
-    bool show_json = false;
-    bool show_pkg_list = false;
+    OutputOptions opts;
     bool show_stdlib = false;
-    bool no_header = false;
-    bool show_dot = false;
-    bool no_pkg = false;
-    bool show_full_path = false;
-    std::string why_lib;
     std::string completion_shell;
+    size_t jobs = 1;
+    bool use_disk_cache = false;
+    bool serve = false;
+    bool no_daemon = false;
+    bool show_stats = false;
+    std::string trace_path;
+    std::vector<std::string> sysroots;
 
     auto* mode = app.add_option_group("Mode");
-    mode->add_flag("--tree", show_tree, "Show dependency tree");
-    mode->add_flag("--json", show_json, "Output in JSON format");
-    mode->add_flag("--pkg-list", show_pkg_list,
+    mode->add_flag("--tree", opts.show_tree, "Show dependency tree");
+    mode->add_flag("--json", opts.show_json, "Output in JSON format");
+    mode->add_flag("--ndjson", opts.show_ndjson, "Output one JSON record per library and per binary");
+    mode->add_flag("--pkg-list", opts.show_pkg_list,
                    "List minimal set of packages required by the binary (Arch Linux only)");
-    mode->add_option("--why", why_lib, "Explain why a library is needed");
-    mode->add_flag("--dot", show_dot, "Output DOT graph");
+    mode->add_option("--why", opts.why_lib, "Explain why a library is needed (shortest chain)");
+    mode->add_flag("--dot", opts.show_dot, "Output DOT graph");
+    mode->add_flag("--dominators", opts.show_dominators,
+                   "Show how many libraries and bytes each library exclusively pulls in");
+    mode->add_flag("--cost", opts.show_cost, "Rank libraries by estimated dynamic-linking startup work");
+    mode->add_flag("--unused", opts.show_unused, "List DT_NEEDED entries that no symbol binds to");
+    mode->add_flag("--footprint", opts.show_footprint, "Show mapped memory per library: text, rodata, data, bss, relro");
+    mode->add_flag("--interpose", opts.show_interpose, "List symbols defined by several libraries and which one wins");
+    mode->add_option("--rdeps", opts.rdeps_lib,
+                     "List files that load LIB, from an index of the system directories (or the given ones)")
+        ->option_text("LIB");
+    mode->add_flag("--watch", opts.watch,
+                   "Keep the graphs up to date as libraries change and print each change as NDJSON");
+    mode->add_option("--diff", opts.diff_paths, "Compare two binaries or two saved --json outputs")
+        ->expected(2)
+        ->option_text("A B");
 
     app.add_option("--completions", completion_shell, "Generate shell completions (bash, zsh, fish)")
        ->option_text("SHELL");
 
+    app.add_option("--why-limit", opts.why_limit, "With --why, list the K shortest chains")->option_text("K");
+    app.add_flag("--why-count", opts.why_count, "With --why, count the chains instead of listing them");
     app.add_flag("--show-stdlib", show_stdlib, "Show standard library dependencies");
-    app.add_flag("--no-header", no_header, "Disable output header");
-    app.add_flag("--no-pkg", no_pkg, "Disable package resolution");
-    app.add_flag("--full-path", show_full_path, "Show full library paths");
+    app.add_flag("--no-header", opts.no_header, "Disable output header");
+    app.add_flag("--no-pkg", opts.no_pkg, "Disable package resolution");
+    app.add_flag("--full-path", opts.show_full_path, "Show full library paths");
+    app.add_option("-j,--jobs", jobs, "Parse and resolve libraries on N threads (0 = all cores)")
+       ->option_text("N");
+    app.add_flag("--cache", use_disk_cache,
+                 "Cache parsed dynamic sections and the package file index in $XDG_CACHE_HOME/inspect-deps");
+    app.add_flag("--serve", serve, "Run as a daemon keeping caches warm; later invocations forward to it");
+    app.add_flag("--no-daemon", no_daemon, "Do not forward to a running daemon");
+    app.add_flag("--stats", show_stats, "Print per-phase timings and counters to stderr");
+    app.add_option("--trace", trace_path, "Write a Chrome trace-event JSON file")->option_text("FILE");
+    app.add_option("--sysroot", sysroots,
+                   "Resolve inside an extracted image root or tar layers LAYER[:LAYER...] (repeat to scan several)")
+       ->allow_extra_args(false)
+       ->option_text("ROOT");
 
     CLI11_PARSE(app, argc, argv);
 
     if (!completion_shell.empty())
     {
-        generate_completions(app, completion_shell);
+        OutputWriter out;
+        generate_completions(out, app, completion_shell);
         return 0;
     }
 
-    if (elf_path.empty())
+    if (serve)
     {
-        std::println(std::cerr, "Error: Target binary is required.");
-        std::println("{}", app.help());
-        return 1;
+        if (shared)
+        {
+            std::println(std::cerr, "Error: --serve cannot be forwarded to a daemon.");
+            return 1;
+        }
+        return Daemon(use_disk_cache).run();
     }
 
-    if (!fs::exists(elf_path))
+    if (!opts.rdeps_lib.empty() && !sysroots.empty())
     {
-        std::println(std::cerr, "Error: File not found.");
+        std::println(std::cerr, "Error: --rdeps cannot be combined with --sysroot.");
         return 1;
     }
 
-    bool use_color = isatty(fileno(stdout));
-
-    DepGraph graph;
-    graph.build(fs::absolute(elf_path).string(), show_stdlib, !no_pkg);
-
-    if (show_json)
+    if (opts.watch && (shared || !sysroots.empty()))
     {
-        std::map<std::string, std::map<std::string, std::string>> out_deps;
-        for (const auto& [k, n] : graph.nodes)
-        {
-            out_deps[k] = {
-                {"path", n.path},
-                {"pkg", n.pkg},
-                {"depth", std::to_string(n.depth)}
-            };
-        }
-
-        auto minimal = graph.get_minimal_pkgs();
-
-        JsonOutput out{graph.root_name, out_deps, minimal};
-        std::string buffer;
-        if (glz::write_json(out, buffer))
-        {
-            std::println(std::cerr, "Error writing JSON");
-        }
-        std::println("{}", buffer);
+        std::println(std::cerr, "Error: --watch runs on the host only, without a daemon or --sysroot.");
+        return 1;
     }
-    else if (show_tree)
+
+    if (!opts.diff_paths.empty() && !sysroots.empty())
     {
-        print_tree(graph, graph.root_name, !no_pkg && graph.alpm.is_available(), use_color, show_full_path);
+        std::println(std::cerr, "Error: --diff cannot be combined with --sysroot.");
+        return 1;
     }
-    else if (show_pkg_list)
+
+    if (!opts.diff_paths.empty() && (opts.diff_paths.size() != 2 || !elf_paths.empty()))
     {
-        if (!graph.alpm.is_available())
-        {
-            std::println(std::cerr, "Error: libalpm not loaded. Cannot resolve packages.");
-            return 1;
-        }
-        auto pkgs = graph.get_minimal_pkgs();
-        for (size_t i = 0; i < pkgs.size(); ++i)
-        {
-            std::print("{}{}", pkgs[i], (i == pkgs.size() - 1 ? "" : " "));
-        }
-        std::println("");
+        std::println(std::cerr, "Error: --diff takes exactly two binaries or --json files.");
+        return 1;
     }
-    else if (!why_lib.empty())
+
+    if (elf_paths.empty() && opts.rdeps_lib.empty() && opts.diff_paths.empty())
     {
-        explain_why(graph, why_lib, show_full_path);
+        std::println(std::cerr, "Error: Target binary is required.");
+        OutputWriter out;
+        out.println("{}", app.help());
+        return 1;
     }
-    else if (show_dot)
+
+    // The daemon's caches describe the host; image scans run here.
+    if (!shared && !no_daemon && !opts.watch && sysroots.empty())
     {
-        std::println("digraph deps {{");
-        std::println("  rankdir=LR;");
-        for (const auto& [p, n] : graph.nodes)
-        {
-            std::string p_name = (show_full_path && !n.path.empty()) ? n.path : p;
-            for (const auto& c : n.children)
-            {
-                std::string c_name = c;
-                if (show_full_path && graph.nodes.contains(c))
-                {
-                    const auto& c_node = graph.nodes.at(c);
-                    if (!c_node.path.empty()) c_name = c_node.path;
-                }
-                std::println(R"(  "{}" -> "{}";)", p_name, c_name);
-            }
-        }
-        std::println("}}");
+        if (auto rc = forward_to_daemon(argc, argv)) return *rc;
     }
-    else
-    {
-        size_t w = 0;
-        for (const auto& [k, n] : graph.nodes)
-        {
-            size_t len = (show_full_path && !n.path.empty()) ? n.path.length() : k.length();
-            w = std::max(w, len);
-        }
-
-        bool show_pkgs = graph.alpm.is_available() && !no_pkg;
-
-        std::string bold = use_color ? "\033[1m" : "";
-        std::string reset = use_color ? "\033[0m" : "";
 
-        if (!no_header)
-        {
-            if (show_pkgs)
-            {
-                std::println("{}{:<{}}  {:<16} {:<6} {}{}", bold, "Library", w + 2, "Package", "Depth", "Required By",
-                             reset);
-            }
-            else
-            {
-                std::println("{}{:<{}}  {:<6} {}{}", bold, "Library", w + 2, "Depth", "Required By", reset);
-            }
-        }
+    Stats::start(show_stats, !trace_path.empty());
 
-        std::vector<std::string> sorted_keys;
-        for (const auto& k : graph.nodes | std::views::keys) sorted_keys.push_back(k);
-        r::sort(sorted_keys);
+    if (!shared && sysroots.empty())
+    {
+        shared = std::make_shared<LibraryCache>();
+        if (use_disk_cache) shared->open_disk_cache();
+    }
 
-        for (const auto& k : sorted_keys)
-        {
-            const auto& n = graph.nodes.at(k);
-            std::string parent = "-";
-            if (!n.parents.empty())
-            {
-                parent = n.parents[0];
-                if (show_full_path && graph.nodes.contains(parent))
-                {
-                    const auto& p_node = graph.nodes.at(parent);
-                    if (!p_node.path.empty()) parent = p_node.path;
-                }
-                if (n.parents.size() > 1) parent += " (+)";
-            }
+    opts.use_color = isatty(fileno(stdout));
 
-            std::string display_name = (show_full_path && !n.path.empty()) ? n.path : k;
+    if (jobs == 0) jobs = std::max(1u, std::thread::hardware_concurrency());
+    // Symbol binding needs the whole global scope, glibc included.
+    if (opts.show_unused || opts.show_interpose) show_stdlib = true;
 
-            if (show_pkgs)
-            {
-                std::string pkg_str = n.pkg.empty() ? "-" : n.pkg;
-                std::println("{:<{}}  {:<16} {:<6} {}", display_name, w + 2, pkg_str.substr(0, 14), n.depth, parent);
-            }
-            else
-            {
-                std::println("{:<{}}  {:<6} {}", display_name, w + 2, n.depth, parent);
-            }
-        }
+    const bool batch = elf_paths.size() > 1 || r::any_of(elf_paths, [](const std::string& p)
+    {
+        return p == "-" || fs::is_directory(p);
+    });
+    int rc = 0;
+    if (opts.watch) rc = Watcher(opts, show_stdlib, jobs, use_disk_cache, shared).run(elf_paths);
+    else if (!opts.diff_paths.empty()) rc = run_diff(opts.diff_paths, opts, show_stdlib, jobs, shared);
+    else if (!opts.rdeps_lib.empty()) rc = run_rdeps(opts.rdeps_lib, elf_paths, opts, jobs, shared);
+    else if (!sysroots.empty()) rc = run_sysroots(sysroots, elf_paths, opts, show_stdlib, jobs, use_disk_cache);
+    else if (batch) rc = run_batch(elf_paths, opts, show_stdlib, jobs, shared);
+    else rc = run_single(elf_paths.front(), opts, show_stdlib, jobs, shared);
+
+    std::cout.flush();
+    if (show_stats) Stats::print_report();
+    if (!trace_path.empty() && !Stats::write_trace(trace_path))
+    {
+        std::println(std::cerr, "Error: cannot write trace to {}", trace_path);
+        return 1;
     }
+    return rc;
+}
 
-    return 0;
+// The bench target compiles this file into its own binary.
+#ifndef INSPECT_DEPS_NO_MAIN
+int main(int argc, char** argv)
+{
+    return run_cli(argc, argv);
 }
+#endif
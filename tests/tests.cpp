@@ -0,0 +1,372 @@
+// Regression tests for inspect-deps on synthetic ELF trees and tar layers.
+//
+// Each test writes its inputs into a temp dir with the benchmark's ELF generator, runs the CLI
+// in-process with stdout captured, and checks the concrete output and exit status. Prints one
+// line per test and exits non-zero if any check failed.
+
+#define INSPECT_DEPS_NO_MAIN
+#include "../main.cpp"
+#include "../bench/synthetic_elf.hpp"
+
+#include <source_location>
+
+namespace
+{
+int failures = 0;
+
+void check(bool ok, std::string_view what, std::source_location loc = std::source_location::current())
+{
+    if (ok) return;
+    ++failures;
+    std::println(std::cerr, "  {}:{}: check failed: {}", fs::path(loc.file_name()).filename().string(), loc.line(),
+                 what);
+}
+
+// A fresh directory under $TMPDIR, removed again with the test.
+class TempDir
+{
+    fs::path dir;
+
+public:
+    TempDir()
+    {
+        std::string tmpl = (fs::temp_directory_path() / "inspect-deps-test.XXXXXX").string();
+        if (!mkdtemp(tmpl.data())) throw std::runtime_error(std::format("mkdtemp: {}", std::strerror(errno)));
+        dir = tmpl;
+    }
+
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+
+    ~TempDir()
+    {
+        std::error_code ec;
+        fs::remove_all(dir, ec);
+    }
+
+    // `name` relative to the directory, with its parents created.
+    std::string operator/(std::string_view name) const
+    {
+        const auto p = dir / name;
+        fs::create_directories(p.parent_path());
+        return p.string();
+    }
+};
+
+SyntheticElf library(std::string soname, std::vector<std::string> needed = {}, std::vector<std::string> exports = {})
+{
+    SyntheticElf elf;
+    elf.soname = std::move(soname);
+    elf.needed = std::move(needed);
+    elf.exports = std::move(exports);
+    elf.search_path = "$ORIGIN";
+    return elf;
+}
+
+SyntheticElf binary(std::vector<std::string> needed, std::vector<std::string> imports = {})
+{
+    SyntheticElf elf;
+    elf.needed = std::move(needed);
+    elf.imports = std::move(imports);
+    elf.search_path = "$ORIGIN/../lib";
+    return elf;
+}
+
+struct CliResult
+{
+    int status;
+    std::string out;
+};
+
+// Runs inspect-deps in this process with stdout redirected into a temp file.
+CliResult run(std::vector<std::string> args)
+{
+    args.insert(args.begin(), "inspect-deps");
+    args.emplace_back("--no-daemon");
+    std::vector<char*> argv;
+    for (auto& a : args) argv.push_back(a.data());
+    argv.push_back(nullptr);
+
+    std::cout.flush();
+    std::fflush(stdout);
+    FILE* capture = std::tmpfile();
+    if (!capture) throw std::runtime_error(std::format("tmpfile: {}", std::strerror(errno)));
+    const int saved = dup(STDOUT_FILENO);
+    dup2(fileno(capture), STDOUT_FILENO);
+
+    CliResult result{run_cli(static_cast<int>(args.size()), argv.data()), {}};
+
+    std::cout.flush();
+    std::fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    std::rewind(capture);
+    char buf[4096];
+    while (const size_t n = std::fread(buf, 1, sizeof(buf), capture)) result.out.append(buf, n);
+    std::fclose(capture);
+    return result;
+}
+
+// Output lines split into whitespace-separated columns.
+std::vector<std::vector<std::string>> rows(std::string_view text)
+{
+    std::vector<std::vector<std::string>> out;
+    for (const auto line : text | v::split('\n'))
+    {
+        std::vector<std::string> cols;
+        for (const auto col : std::string_view(line.begin(), line.end()) | v::split(' '))
+        {
+            if (!col.empty()) cols.emplace_back(col.begin(), col.end());
+        }
+        if (!cols.empty()) out.push_back(std::move(cols));
+    }
+    return out;
+}
+
+// Overwrites a file with zeros of the same size and restores its mtime, so anything that
+// still reports its old contents read them from a cache keyed by (inode, mtime, size).
+void blank_keeping_identity(const std::string& path)
+{
+    struct stat st{};
+    if (::stat(path.c_str(), &st) != 0) throw std::runtime_error("cannot stat " + path);
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::in | std::ios::out);
+        const std::string zeros(static_cast<size_t>(st.st_size), '\0');
+        out.write(zeros.data(), static_cast<std::streamsize>(zeros.size()));
+    }
+    const timespec times[2] = {st.st_atim, st.st_mtim};
+    utimensat(AT_FDCWD, path.c_str(), times, 0);
+}
+
+struct TarMember
+{
+    std::string name;
+    char type = '0';
+    std::string data;
+};
+
+// A plain ustar layer.
+void write_tar(const std::string& path, const std::vector<TarMember>& members)
+{
+    std::string out;
+    for (const auto& m : members)
+    {
+        char header[512]{};
+        std::memcpy(header, m.name.data(), std::min<size_t>(m.name.size(), 99));
+        std::memcpy(header + 100, m.type == '5' ? "0000755" : "0000644", 7);
+        std::memcpy(header + 108, "0000000", 7);
+        std::memcpy(header + 116, "0000000", 7);
+        std::format_to(header + 124, "{:011o}", m.data.size());
+        std::memcpy(header + 136, "00000000000", 11);
+        header[156] = m.type;
+        std::memcpy(header + 257, "ustar\0" "00", 8);
+
+        std::memset(header + 148, ' ', 8);
+        unsigned sum = 0;
+        for (const char c : header) sum += static_cast<unsigned char>(c);
+        std::format_to(header + 148, "{:06o}", sum);
+        header[154] = '\0';
+
+        out.append(header, sizeof(header));
+        out += m.data;
+        out.append((512 - m.data.size() % 512) % 512, '\0');
+    }
+    out.append(1024, '\0');
+    std::ofstream(path, std::ios::binary).write(out.data(), static_cast<std::streamsize>(out.size()));
+}
+
+// app imports one function from libused.so and nothing from libidle.so.
+void test_unused()
+{
+    TempDir t;
+    write_elf(t / "bin/app", binary({"libused.so", "libidle.so"}, {"used_fn"}));
+    write_elf(t / "lib/libused.so", library("libused.so", {}, {"used_fn"}));
+    write_elf(t / "lib/libidle.so", library("libidle.so", {}, {"idle_fn"}));
+
+    const auto r = run({t / "bin/app", "--unused", "--no-header", "--no-pkg"});
+    check(r.status == 0, "exit status 0");
+    check(rows(r.out) == std::vector<std::vector<std::string>>{{"app", "libidle.so"}}, "only libidle.so is unused");
+}
+
+// app -> A, B; A -> C, D; B -> C. Only D hangs off A alone.
+void test_dominators()
+{
+    TempDir t;
+    write_elf(t / "bin/app", binary({"libA.so", "libB.so"}));
+    write_elf(t / "lib/libA.so", library("libA.so", {"libC.so", "libD.so"}));
+    write_elf(t / "lib/libB.so", library("libB.so", {"libC.so"}));
+    write_elf(t / "lib/libC.so", library("libC.so"));
+    write_elf(t / "lib/libD.so", library("libD.so"));
+
+    const auto r = run({t / "bin/app", "--dominators", "--no-header", "--no-pkg"});
+    check(r.status == 0, "exit status 0");
+
+    std::map<std::string, std::pair<std::string, std::string>> found;
+    for (const auto& row : rows(r.out))
+    {
+        if (row.size() == 4) found[row[0]] = {row[1], row[3]};
+    }
+    const std::map<std::string, std::pair<std::string, std::string>> expected = {
+        {"app", {"5", "-"}}, {"libA.so", {"2", "app"}}, {"libB.so", {"1", "app"}},
+        {"libC.so", {"1", "app"}}, {"libD.so", {"1", "libA.so"}},
+    };
+    check(found == expected, "libs and dominator per library");
+}
+
+// Exit status like diff(1): 0 when equal, 1 when different, 2 when an input can't be read.
+void test_diff_status()
+{
+    TempDir t;
+    write_elf(t / "bin/app1", binary({"libA.so", "libB.so"}));
+    write_elf(t / "bin/app2", binary({"libA.so", "libC.so"}));
+    for (const auto* name : {"libA.so", "libB.so", "libC.so"})
+        write_elf(t / std::format("lib/{}", name), library(name));
+
+    const auto same = run({"--diff", t / "bin/app1", t / "bin/app1", "--no-pkg"});
+    check(same.status == 0, "identical graphs exit 0");
+
+    const auto changed = run({"--diff", t / "bin/app1", t / "bin/app2", "--no-pkg", "--no-header"});
+    check(changed.status == 1, "differing graphs exit 1");
+    check(changed.out.contains("libB.so") && changed.out.contains("libC.so"), "removed and added libraries listed");
+    check(!changed.out.contains("libA.so"), "shared library not listed");
+
+    const auto missing = run({"--diff", t / "bin/app1", t / "bin/none", "--no-pkg"});
+    check(missing.status == 2, "missing input exits 2");
+}
+
+// ".wh.NAME" hides NAME from the layers below, ".wh..wh..opq" everything below in its directory.
+void test_whiteouts()
+{
+    TempDir t;
+    write_tar(t / "base.tar", {
+        {"usr/", '5', {}}, {"usr/lib/", '5', {}}, {"usr/lib/libgone.so", '0', "gone"},
+        {"usr/lib/libkept.so", '0', "kept"}, {"opt/", '5', {}}, {"opt/app/", '5', {}},
+        {"opt/app/old", '0', "old"},
+    });
+    write_tar(t / "top.tar", {
+        {"usr/lib/.wh.libgone.so", '0', {}}, {"opt/app/.wh..wh..opq", '0', {}}, {"opt/app/new", '0', "new"},
+    });
+
+    const auto image = ImageArchive::open({t / "base.tar", t / "top.tar"});
+    check(image != nullptr, "layers index");
+    if (!image) return;
+
+    check(!image->resolve("/usr/lib/libgone.so"), "whiteout hides the lower file");
+    check(image->contents("usr/lib/libkept.so") == "kept", "sibling of a whiteout stays");
+    check(!image->resolve("/opt/app/old"), "opaque directory hides lower entries");
+    check(image->contents("opt/app/new") == "new", "opaque directory keeps its own layer");
+
+    const auto* listing = image->list("usr/lib");
+    check(listing && listing->size() == 1 && listing->front().first == "libkept.so", "listing omits whiteouts");
+}
+
+// Dynamic sections of both byte orders survive the --cache file, and a warm run answers from it
+// even once the files are unreadable.
+void test_dynamic_cache_round_trip()
+{
+    TempDir t;
+    auto le = library("liblittle.so", {"libdep.so"});
+    auto be = library("libbig.so", {"libdep.so", "libother.so"});
+    be.big_endian = true;
+    be.machine = EM_PPC64;
+    write_elf(t / "lib/liblittle.so", le);
+    write_elf(t / "lib/libbig.so", be);
+
+    std::vector<DynamicInfo> before;
+    {
+        DynamicCache cache(t / "cache/dynamic.cache");
+        for (const auto* name : {"lib/liblittle.so", "lib/libbig.so"})
+        {
+            auto info = cache.load(t / name);
+            check(info.has_value(), std::format("{} parses", name));
+            before.push_back(info.value_or(DynamicInfo{}));
+        }
+        cache.save();
+    }
+    check(before[0].needed == le.needed && before[0].soname == "liblittle.so", "little-endian fields");
+    check(before[1].needed == be.needed && before[1].soname == "libbig.so" && before[1].arch.machine == EM_PPC64,
+          "big-endian fields");
+
+    blank_keeping_identity(t / "lib/liblittle.so");
+    blank_keeping_identity(t / "lib/libbig.so");
+
+    DynamicCache cache(t / "cache/dynamic.cache");
+    for (size_t i = 0; const auto* name : {"lib/liblittle.so", "lib/libbig.so"})
+    {
+        const auto info = cache.load(t / name);
+        check(info && info->needed == before[i].needed && info->soname == before[i].soname &&
+              info->runpath == before[i].runpath && info->arch.elf_class == before[i].arch.elf_class &&
+              info->arch.machine == before[i].arch.machine,
+              std::format("{} read back from the cache", name));
+        ++i;
+    }
+}
+
+// rdeps.index built over objects of both byte orders, then queried again from the index alone.
+void test_reverse_index_round_trip()
+{
+    TempDir t;
+    const auto cache_home = t / "cache";
+    setenv("XDG_CACHE_HOME", cache_home.c_str(), 1);
+
+    write_elf(t / "tree/libbase.so", library("libbase.so"));
+    write_elf(t / "tree/libuser.so", library("libuser.so", {"libbase.so"}));
+    auto base_be = library("libbase_be.so");
+    auto user_be = library("libuser_be.so", {"libbase_be.so"});
+    base_be.big_endian = user_be.big_endian = true;
+    base_be.machine = user_be.machine = EM_PPC64;
+    write_elf(t / "tree/libbase_be.so", base_be);
+    write_elf(t / "tree/libuser_be.so", user_be);
+
+    const auto tree = t / "tree";
+    const auto users_of = [&](const std::string& lib)
+    {
+        std::vector<std::string> users;
+        for (const auto& row : rows(run({"--rdeps", lib, tree, "--no-header"}).out))
+        {
+            if (row.size() >= 2 && row[1] != "0") users.push_back(fs::path(row[0]).filename().string());
+        }
+        return users;
+    };
+
+    check(users_of("libbase.so") == std::vector<std::string>{"libuser.so"}, "little-endian user found");
+    check(users_of("libbase_be.so") == std::vector<std::string>{"libuser_be.so"}, "big-endian user found");
+
+    for (const auto* name : {"libbase.so", "libuser.so", "libbase_be.so", "libuser_be.so"})
+        blank_keeping_identity(t / std::format("tree/{}", name));
+
+    check(users_of("libbase.so") == std::vector<std::string>{"libuser.so"}, "little-endian answer from the index");
+    check(users_of("libbase_be.so") == std::vector<std::string>{"libuser_be.so"}, "big-endian answer from the index");
+    check(users_of(t / "tree/libbase_be.so") == std::vector<std::string>{"libuser_be.so"}, "lookup by path");
+    unsetenv("XDG_CACHE_HOME");
+}
+}
+
+int main()
+{
+    const std::array<std::pair<std::string_view, void (*)()>, 6> tests = {{
+        {"unused", test_unused},
+        {"dominators", test_dominators},
+        {"diff_status", test_diff_status},
+        {"whiteouts", test_whiteouts},
+        {"dynamic_cache_round_trip", test_dynamic_cache_round_trip},
+        {"reverse_index_round_trip", test_reverse_index_round_trip},
+    }};
+
+    for (const auto& [name, test] : tests)
+    {
+        const int before = failures;
+        try
+        {
+            test();
+        }
+        catch (const std::exception& e)
+        {
+            ++failures;
+            std::println(std::cerr, "  exception: {}", e.what());
+        }
+        std::println("{} {}", failures == before ? "ok  " : "FAIL", name);
+    }
+    return failures == 0 ? 0 : 1;
+}